@@ -0,0 +1,45 @@
+#include "AllocationCounter.h"
+#include "RealtimeChecker.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<ulong> allocationCount(0);
+static std::atomic<uint64_t> allocationBytes(0);
+
+ulong AllocationCounter::getCount() {
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::getBytes() {
+  return allocationBytes.load(std::memory_order_relaxed);
+}
+
+#if ALLOCATION_COUNTER_ENABLED
+// The array and nothrow forms all forward to these by default
+void* operator new(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocationBytes.fetch_add(size, std::memory_order_relaxed);
+#if !REALTIME_CHECKER_MALLOC_HOOK
+  RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+#endif
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+#if !REALTIME_CHECKER_MALLOC_HOOK
+  if (p != nullptr) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Free);
+  }
+#endif
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+#endif
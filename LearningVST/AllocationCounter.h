@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include "Types.h"
+
+// Debug builds always count; others can opt in (the benchmarks do)
+#if defined(_DEBUG) || defined(LEARNINGVST_COUNT_ALLOCATIONS)
+#define ALLOCATION_COUNTER_ENABLED 1
+#else
+#define ALLOCATION_COUNTER_ENABLED 0
+#endif
+
+// Counts heap allocations made through the global operator new, and the bytes
+// asked for. Only builds with ALLOCATION_COUNTER_ENABLED replace the
+// operators; others always report zero.
+class AllocationCounter {
+public:
+  static inline bool isEnabled() {
+    return ALLOCATION_COUNTER_ENABLED != 0;
+  }
+
+  static ulong getCount();
+  static uint64_t getBytes();
+};
@@ -0,0 +1,295 @@
+#include "AudioAnalyzer.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <string.h>
+#include "AudioKernels.h"
+#include "Json.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// BS.1770-4 Annex 2 interpolation filter, one row per output phase. The rows
+// are mirror images of each other, so which way the window runs doesn't
+// change the peak.
+static const double kTruePeakTaps[AudioAnalyzer::kOversampling][AudioAnalyzer::kTapsPerPhase] = {
+  { 0.0017089843750, 0.0109863281250, -0.0196533203125, 0.0332031250000,
+    -0.0594482421875, 0.1373291015625, 0.9721679687500, -0.1022949218750,
+    0.0476074218750, -0.0266113281250, 0.0148925781250, -0.0083007812500 },
+  { -0.0291748046875, 0.0292968750000, -0.0517578125000, 0.0891113281250,
+    -0.1665039062500, 0.4650878906250, 0.7797851562500, -0.2003173828125,
+    0.1015625000000, -0.0582275390625, 0.0330810546875, -0.0189208984375 },
+  { -0.0189208984375, 0.0330810546875, -0.0582275390625, 0.1015625000000,
+    -0.2003173828125, 0.7797851562500, 0.4650878906250, -0.1665039062500,
+    0.0891113281250, -0.0517578125000, 0.0292968750000, -0.0291748046875 },
+  { -0.0083007812500, 0.0148925781250, -0.0266113281250, 0.0476074218750,
+    -0.1022949218750, 0.9721679687500, 0.1373291015625, -0.0594482421875,
+    0.0332031250000, -0.0196533203125, 0.0109863281250, 0.0017089843750 },
+};
+
+// WAVE_FORMAT_EXTENSIBLE speaker bits with a loudness weighting other than 1
+static constexpr uint kSpeakerLowFrequency = 0x8;
+static constexpr uint kSpeakerSurrounds = 0x10 | 0x20 | 0x200 | 0x400; // Back and side left/right
+
+static double gainToDb(double gain) {
+  return 20.0 * log10(gain);
+}
+
+static double powerToLufs(double power) {
+  return -0.691 + (10.0 * log10(power));
+}
+
+AudioAnalyzer::AudioAnalyzer(ushort numChannels, double sampleRate, ulong blockSize, uint channelMask) {
+  this->sampleRate = sampleRate;
+  this->blockSize = blockSize;
+  this->segmentFrames = std::max(static_cast<ulong>(1), static_cast<ulong>(sampleRate / 10.0 + 0.5));
+
+  // K-weighting filters, designed for our sample rate from the analog
+  // prototypes behind the 48kHz coefficients in BS.1770
+  Biquad preFilter;
+  {
+    const double f0 = 1681.974450955533;
+    const double gainDb = 3.999843853973347;
+    const double q = 0.7071752369554196;
+    const double k = tan(M_PI * f0 / sampleRate);
+    const double vh = pow(10.0, gainDb / 20.0);
+    const double vb = pow(vh, 0.4996667741545416);
+    const double a0 = 1.0 + (k / q) + (k * k);
+    preFilter.b0 = (vh + (vb * k / q) + (k * k)) / a0;
+    preFilter.b1 = 2.0 * ((k * k) - vh) / a0;
+    preFilter.b2 = (vh - (vb * k / q) + (k * k)) / a0;
+    preFilter.a1 = 2.0 * ((k * k) - 1.0) / a0;
+    preFilter.a2 = (1.0 - (k / q) + (k * k)) / a0;
+  }
+
+  Biquad rlbFilter;
+  {
+    const double f0 = 38.13547087602444;
+    const double q = 0.5003270373238773;
+    const double k = tan(M_PI * f0 / sampleRate);
+    const double a0 = 1.0 + (k / q) + (k * k);
+    rlbFilter.b0 = 1.0;
+    rlbFilter.b1 = -2.0;
+    rlbFilter.b2 = 1.0;
+    rlbFilter.a1 = 2.0 * ((k * k) - 1.0) / a0;
+    rlbFilter.a2 = (1.0 - (k / q) + (k * k)) / a0;
+  }
+
+  // Channels take the mask's speakers in order; any past the last one are
+  // unpositioned and weighted as front channels
+  channels.resize(numChannels);
+  uint remainingSpeakers = channelMask;
+  for (auto& channel : channels) {
+    uint speaker = remainingSpeakers & (~remainingSpeakers + 1);
+    remainingSpeakers &= ~speaker;
+
+    if (speaker & kSpeakerLowFrequency) {
+      channel.weight = 0.0;
+    }
+    else if (speaker & kSpeakerSurrounds) {
+      channel.weight = 1.41;
+    }
+
+    channel.preFilter = preFilter;
+    channel.rlbFilter = rlbFilter;
+    channel.history.assign(kTapsPerPhase - 1 + blockSize, 0.0);
+  }
+
+  silence.assign(blockSize, 0.0);
+  silentChannels.assign(numChannels, silence.data());
+
+  const size_t numBins = static_cast<size_t>((kMaxLufs - kAbsoluteGateLufs) * kHistogramBinsPerLu) + 1;
+  histogramCounts.assign(numBins, 0);
+  histogramPowers.assign(numBins, 0.0);
+}
+
+void AudioAnalyzer::processSilence(ulong numFrames) {
+  while (numFrames > 0) {
+    ulong chunkFrames = std::min(numFrames, blockSize);
+    processChannels(silentChannels.data(), chunkFrames);
+    numFrames -= chunkFrames;
+  }
+}
+
+template <typename T> void AudioAnalyzer::processChannels(const T* const* samples, ulong numFrames) {
+  // Segments rarely line up with blocks, so split the block where one ends
+  ulong offset = 0;
+  while (offset < numFrames) {
+    ulong chunkFrames = std::min(numFrames - offset, segmentFrames - framesInSegment);
+    for (size_t c = 0; c < channels.size(); ++c) {
+      analyzeChannel(channels[c], samples[c] + offset, chunkFrames);
+    }
+
+    offset += chunkFrames;
+    framesInSegment += chunkFrames;
+    this->numFrames += chunkFrames;
+    if (framesInSegment == segmentFrames) {
+      endSegment();
+    }
+  }
+}
+
+template <typename T> void AudioAnalyzer::analyzeChannel(Channel& channel, const T* samples, ulong numFrames) {
+  channel.peak = std::max(channel.peak, static_cast<double>(AudioKernels::peakAbs(samples, numFrames)));
+  channel.sumSquares += AudioKernels::sumSquares(samples, numFrames);
+
+  // K-weight for loudness, keeping the samples after the previous chunk's
+  // tail for the true peak filter
+  double* history = channel.history.data();
+  double* current = history + (kTapsPerPhase - 1);
+  double segmentSumSquares = 0.0;
+  for (ulong s = 0; s < numFrames; ++s) {
+    double sample = static_cast<double>(samples[s]);
+    current[s] = sample;
+
+    double weighted = channel.rlbFilter.process(channel.preFilter.process(sample));
+    segmentSumSquares += weighted * weighted;
+  }
+  channel.segmentSumSquares += segmentSumSquares;
+
+  // Every input sample yields kOversampling interpolated ones
+  double truePeak = channel.truePeak;
+  for (ulong s = 0; s < numFrames; ++s) {
+    const double* window = history + s;
+    for (uint phase = 0; phase < kOversampling; ++phase) {
+      double interpolated = 0.0;
+      for (uint tap = 0; tap < kTapsPerPhase; ++tap) {
+        interpolated += kTruePeakTaps[phase][tap] * window[tap];
+      }
+      truePeak = std::max(truePeak, fabs(interpolated));
+    }
+  }
+  channel.truePeak = truePeak;
+
+  memmove(history, history + numFrames, sizeof(double) * (kTapsPerPhase - 1));
+}
+
+template void AudioAnalyzer::processChannels<float>(const float* const*, ulong);
+template void AudioAnalyzer::processChannels<double>(const double* const*, ulong);
+
+void AudioAnalyzer::endSegment() {
+  double power = 0.0;
+  for (auto& channel : channels) {
+    power += channel.weight * channel.segmentSumSquares / static_cast<double>(segmentFrames);
+    channel.segmentSumSquares = 0.0;
+  }
+  framesInSegment = 0;
+
+  segmentPowers[numSegments % kSegmentsPerBlock] = power;
+  if (++numSegments < kSegmentsPerBlock) {
+    return;
+  }
+
+  // A gating block ends with every segment
+  double blockPower = 0.0;
+  for (auto segmentPower : segmentPowers) {
+    blockPower += segmentPower;
+  }
+  blockPower /= static_cast<double>(kSegmentsPerBlock);
+
+  double blockLufs = powerToLufs(blockPower);
+  if (!(blockLufs > kAbsoluteGateLufs)) {
+    return;
+  }
+
+  size_t bin = std::min(static_cast<size_t>((blockLufs - kAbsoluteGateLufs) * kHistogramBinsPerLu),
+    histogramCounts.size() - 1);
+  ++histogramCounts[bin];
+  histogramPowers[bin] += blockPower;
+}
+
+double AudioAnalyzer::getIntegratedLoudness() const {
+  ulong numBlocks = 0;
+  double totalPower = 0.0;
+  for (size_t bin = 0; bin < histogramCounts.size(); ++bin) {
+    numBlocks += histogramCounts[bin];
+    totalPower += histogramPowers[bin];
+  }
+  if (numBlocks == 0) {
+    return -std::numeric_limits<double>::infinity();
+  }
+
+  // Relative gate: drop blocks more than 10 LU below the absolute-gated level.
+  // Blocks are only known to the bin, so the gate rounds down to one.
+  double relativeGateLufs = powerToLufs(totalPower / static_cast<double>(numBlocks)) + kRelativeGateLu;
+  size_t firstBin = static_cast<size_t>(std::max(0.0,
+    (relativeGateLufs - kAbsoluteGateLufs) * kHistogramBinsPerLu));
+
+  numBlocks = 0;
+  totalPower = 0.0;
+  for (size_t bin = firstBin; bin < histogramCounts.size(); ++bin) {
+    numBlocks += histogramCounts[bin];
+    totalPower += histogramPowers[bin];
+  }
+  if (numBlocks == 0) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  return powerToLufs(totalPower / static_cast<double>(numBlocks)) + gainToDb(outputGain);
+}
+
+// JSON has no infinity; silence comes out as null
+static void writeJsonDb(std::ostream& os, double db) {
+  if (std::isfinite(db)) {
+    os << std::fixed << std::setprecision(2) << db;
+  }
+  else {
+    os << "null";
+  }
+}
+
+bool AudioAnalyzer::writeJson(const std::string& fileName, const std::vector<std::string>& audioFileNames) const {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create analysis file " << fileName << std::endl;
+    return false;
+  }
+
+  double samplePeak = 0.0;
+  double truePeak = 0.0;
+  for (const auto& channel : channels) {
+    samplePeak = std::max(samplePeak, channel.peak * outputGain);
+    truePeak = std::max(truePeak, std::max(channel.truePeak, channel.peak) * outputGain);
+  }
+
+  ofs << "{" << std::endl;
+  writeJsonAudioFiles(ofs, audioFileNames);
+  ofs << "  \"sampleRate\": " << static_cast<ulong>(sampleRate) << "," << std::endl;
+  ofs << "  \"numChannels\": " << channels.size() << "," << std::endl;
+  ofs << "  \"numFrames\": " << numFrames << "," << std::endl;
+  ofs << "  \"integratedLoudnessLufs\": ";
+  writeJsonDb(ofs, getIntegratedLoudness());
+  ofs << "," << std::endl;
+  ofs << "  \"samplePeakDbfs\": ";
+  writeJsonDb(ofs, gainToDb(samplePeak));
+  ofs << "," << std::endl;
+  ofs << "  \"truePeakDbtp\": ";
+  writeJsonDb(ofs, gainToDb(truePeak));
+  ofs << "," << std::endl;
+
+  ofs << "  \"channels\": [" << std::endl;
+  for (size_t c = 0; c < channels.size(); ++c) {
+    const auto& channel = channels[c];
+    double meanSquare = numFrames > 0 ? channel.sumSquares / static_cast<double>(numFrames) : 0.0;
+    meanSquare *= outputGain * outputGain;
+
+    ofs << "    { \"samplePeakDbfs\": ";
+    writeJsonDb(ofs, gainToDb(channel.peak * outputGain));
+    ofs << ", \"rmsDbfs\": ";
+    writeJsonDb(ofs, gainToDb(sqrt(meanSquare)));
+    ofs << ", \"truePeakDbtp\": ";
+    writeJsonDb(ofs, gainToDb(std::max(channel.truePeak, channel.peak) * outputGain));
+    ofs << " }" << (c + 1 < channels.size() ? "," : "") << std::endl;
+  }
+  ofs << "  ]" << std::endl;
+  ofs << "}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing analysis file " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <assert.h>
+#include "Types.h"
+#include "SampleBuffer.h"
+
+// Measures the output as it is rendered, so QC doesn't need a second pass
+// over the file: per channel sample peak, RMS and true peak (ITU-R BS.1770-4
+// Annex 2, 4x oversampled), and integrated loudness (BS.1770-4 / EBU R128:
+// K-weighted, 400ms blocks overlapping by 75%, absolute and relative gates).
+// All memory is allocated up front; blocks are gated through a histogram
+// rather than kept, so render length doesn't matter.
+class AudioAnalyzer {
+public:
+  static constexpr uint kOversampling = 4;
+  static constexpr uint kTapsPerPhase = 12;
+  static constexpr uint kSegmentsPerBlock = 4; // 100ms segments per 400ms gating block
+  static constexpr double kAbsoluteGateLufs = -70.0;
+  static constexpr double kRelativeGateLu = -10.0;
+  static constexpr double kMaxLufs = 10.0;     // Louder blocks go in the top bin
+  static constexpr uint kHistogramBinsPerLu = 100;
+
+protected:
+  // Transposed direct form II
+  struct Biquad {
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+    double z1 = 0.0, z2 = 0.0;
+
+    inline double process(double x) {
+      double y = (b0 * x) + z1;
+      z1 = (b1 * x) - (a1 * y) + z2;
+      z2 = (b2 * x) - (a2 * y);
+      return y;
+    }
+  };
+
+  struct Channel {
+    double weight = 1.0; // Contribution to loudness; 0 for LFE
+    double peak = 0.0;
+    double sumSquares = 0.0;
+    double truePeak = 0.0;
+    Biquad preFilter;    // K-weighting stage 1: head shelf
+    Biquad rlbFilter;    // K-weighting stage 2: high pass
+    double segmentSumSquares = 0.0; // K-weighted, for the current segment
+    std::vector<double> history;    // Last kTapsPerPhase - 1 samples, then the current chunk
+  };
+
+  std::vector<Channel> channels;
+  std::vector<double> silence;               // A block of zeros, for processSilence
+  std::vector<const double*> silentChannels; // Points every channel at it
+  double sampleRate;
+  ulong blockSize;
+  ulong numFrames = 0;
+  double outputGain = 1.0;
+
+  ulong segmentFrames;
+  ulong framesInSegment = 0;
+  std::array<double, kSegmentsPerBlock> segmentPowers = { };
+  ulong numSegments = 0;
+
+  // Gating blocks by loudness: how many fell in each bin, and their total power
+  std::vector<ulong> histogramCounts;
+  std::vector<double> histogramPowers;
+
+  template <typename T> void processChannels(const T* const* samples, ulong numFrames);
+  template <typename T> void analyzeChannel(Channel& channel, const T* samples, ulong numFrames);
+  void endSegment();
+
+public:
+  // channelMask gives each channel's speaker (as in WAVE_FORMAT_EXTENSIBLE),
+  // which decides its loudness weighting
+  AudioAnalyzer(ushort numChannels, double sampleRate, ulong blockSize, uint channelMask);
+
+  template <typename T, ushort kChannels> void process(const SampleBuffer<T, kChannels>& sampleBuffer, ulong numFrames) {
+    assert(sampleBuffer.getNumChannels() == channels.size());
+    assert(numFrames <= blockSize);
+    processChannels(sampleBuffer.getSamples(), numFrames);
+  }
+
+  // Frames written without calling the plugin
+  void processSilence(ulong numFrames);
+
+  // Gain applied to the output after analysis (e.g. normalization), which
+  // the results should reflect
+  inline void setOutputGain(double gain) {
+    outputGain = gain;
+  }
+
+  inline ulong getNumFrames() const {
+    return numFrames;
+  }
+
+  // LUFS, or -infinity if nothing got past the absolute gate. The output
+  // gain is applied to the result, not before gating, so a large gain can
+  // move blocks across the absolute gate that it doesn't account for.
+  double getIntegratedLoudness() const;
+
+  // Sidecar for fileName: the results as JSON, for the WAV file or the stems
+  // in audioFileNames (see writeJsonAudioFiles)
+  bool writeJson(const std::string& fileName, const std::vector<std::string>& audioFileNames) const;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <assert.h>
+#include "Types.h"
+#include "SampleBuffer.h"
+
+// Owns every audio buffer a render session needs, allocated once up front.
+// Graph edges declare when they are live, as the span of nodes (in execution
+// order) from the one that writes the edge to the last one that reads it.
+// Edges whose spans don't overlap share a physical buffer, the same way a
+// register allocator assigns registers to virtual registers, so memory use
+// follows the widest point of the graph rather than its number of edges.
+//
+// Buffers are handed over as-is: an edge that no node writes (e.g. the
+// silent input of an instrument) must be cleared by whoever reads it.
+template <typename T, ushort kChannels = kDynamicChannels> class AudioBufferArena {
+public:
+  typedef uint EdgeId;
+
+protected:
+  struct Edge {
+    uint firstNode;
+    uint lastNode;
+    size_t buffer = 0;
+  };
+
+  ushort numChannels;
+  ulong blockSize;
+  std::vector<Edge> edges;
+  std::vector<SampleBuffer<T, kChannels>> buffers;
+
+public:
+  AudioBufferArena(ushort numChannels, ulong blockSize) {
+    this->numChannels = numChannels;
+    this->blockSize = blockSize;
+  }
+
+  // Declares an edge live from firstNode through lastNode inclusive. A node
+  // never shares a buffer between its inputs and outputs, since plugins are
+  // allowed to write their outputs before they've finished reading inputs.
+  EdgeId addEdge(uint firstNode, uint lastNode) {
+    assert(buffers.empty());
+    assert(firstNode <= lastNode);
+
+    Edge edge;
+    edge.firstNode = firstNode;
+    edge.lastNode = lastNode;
+    edges.push_back(edge);
+    return static_cast<EdgeId>(edges.size() - 1);
+  }
+
+  // Assigns edges to buffers and allocates them; no edges can be added after
+  void allocate() {
+    assert(buffers.empty());
+
+    // Linear scan: visit edges in order of first use, retiring the buffers of
+    // edges which ended before it and reusing them
+    std::vector<EdgeId> order(edges.size());
+    for (EdgeId i = 0; i < static_cast<EdgeId>(edges.size()); ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](EdgeId a, EdgeId b) {
+      return edges[a].firstNode < edges[b].firstNode;
+    });
+
+    // Live edges by the node they end on, earliest first
+    typedef std::pair<uint, size_t> LiveEdge;
+    std::priority_queue<LiveEdge, std::vector<LiveEdge>, std::greater<LiveEdge>> liveEdges;
+    std::vector<size_t> freeBuffers;
+    size_t numBuffers = 0;
+
+    for (auto edgeId : order) {
+      auto& edge = edges[edgeId];
+
+      while (!liveEdges.empty() && liveEdges.top().first < edge.firstNode) {
+        freeBuffers.push_back(liveEdges.top().second);
+        liveEdges.pop();
+      }
+
+      if (freeBuffers.empty()) {
+        edge.buffer = numBuffers++;
+      }
+      else {
+        edge.buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+      }
+      liveEdges.push(LiveEdge(edge.lastNode, edge.buffer));
+    }
+
+    buffers.reserve(numBuffers);
+    for (size_t i = 0; i < numBuffers; ++i) {
+      buffers.emplace_back(numChannels, blockSize);
+    }
+  }
+
+  inline SampleBuffer<T, kChannels>& getBuffer(EdgeId edge) {
+    return buffers[edges[edge].buffer];
+  }
+
+  inline size_t getNumEdges() const {
+    return edges.size();
+  }
+
+  inline size_t getNumBuffers() const {
+    return buffers.size();
+  }
+
+  // Sample memory held by the arena (excluding padding)
+  inline size_t getBytesAllocated() const {
+    return buffers.size() * numChannels * blockSize * sizeof(T);
+  }
+};
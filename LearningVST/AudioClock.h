@@ -3,6 +3,7 @@
 #include <math.h>
 #include "Types.h"
 #include "GlobalSettings.h"
+#include "VstSdk.h"
 
 // Implemented as a singleton for simplicity ... use AudioClock::get
 class AudioClock {
@@ -11,7 +12,13 @@ protected:
   bool isPlaying = false;
   unsigned long currentFrame = 0;
 
+  // What audioMasterGetTime hands out. Plugins can ask several times a
+  // block, so it's worked out once whenever the position or the timing
+  // settings change rather than on every call.
+  VstTimeInfo timeInfo = { };
+
   AudioClock() {
+    updateTimeInfo();
   }
 
 public:
@@ -58,6 +65,36 @@ public:
     }
 
     currentFrame += blockSize;
+    updateTimeInfo();
+  }
+
+  // Everything we can tell a plugin about the current position, all marked
+  // valid whatever the plugin asked for
+  inline const VstTimeInfo* getTimeInfo() const {
+    return &timeInfo;
+  }
+
+  // Call after changing tempo, time signature or sample rate mid-render, so
+  // getTimeInfo reflects them
+  void updateTimeInfo() {
+    GlobalSettings& globalSettings = GlobalSettings::get();
+
+    timeInfo.samplePos = static_cast<double>(currentFrame);
+    timeInfo.sampleRate = globalSettings.getSampleRate();
+    timeInfo.tempo = globalSettings.getTempo();
+    timeInfo.ppqPos = getPpqPos();
+    timeInfo.barStartPos = getBarStartPos(timeInfo.ppqPos);
+    timeInfo.timeSigNumerator = globalSettings.getBeatsPerMeasure();
+    timeInfo.timeSigDenominator = globalSettings.getNoteValue();
+
+    // We don't keep real time, so kVstNanosValid is never set
+    timeInfo.flags = kVstPpqPosValid | kVstTempoValid | kVstBarsValid | kVstTimeSigValid;
+    if (transportChanged) {
+      timeInfo.flags |= kVstTransportChanged;
+    }
+    if (isPlaying) {
+      timeInfo.flags |= kVstTransportPlaying;
+    }
   }
 };
 
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "Types.h"
+#include "ChannelCount.h"
+#include <math.h>
+#include <algorithm>
+
+// SSE2 is baseline on every target we build for (x64, and Win32 with the
+// default /arch), but keep a scalar path for anything else
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define AUDIO_KERNELS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Small, hot inner loops shared by the render pipeline
+namespace AudioKernels {
+  // Largest absolute sample value in a run of samples
+  inline float peakAbs(const float* samples, ulong numSamples) {
+    ulong s = 0;
+    float peak = 0.0f;
+
+#if AUDIO_KERNELS_SSE2
+    // Clearing the sign bit is all fabs does; two accumulators to hide latency
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 peak0 = _mm_setzero_ps();
+    __m128 peak1 = _mm_setzero_ps();
+    for (; s + 8 <= numSamples; s += 8) {
+      peak0 = _mm_max_ps(peak0, _mm_and_ps(_mm_loadu_ps(samples + s), absMask));
+      peak1 = _mm_max_ps(peak1, _mm_and_ps(_mm_loadu_ps(samples + s + 4), absMask));
+    }
+    peak0 = _mm_max_ps(peak0, peak1);
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, peak0);
+    peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+
+    for (; s < numSamples; ++s) {
+      peak = std::max(peak, fabsf(samples[s]));
+    }
+    return peak;
+  }
+
+  inline double peakAbs(const double* samples, ulong numSamples) {
+    ulong s = 0;
+    double peak = 0.0;
+
+#if AUDIO_KERNELS_SSE2
+    const __m128d absMask = _mm_castsi128_pd(_mm_set_epi32(0x7FFFFFFF, -1, 0x7FFFFFFF, -1));
+    __m128d peak0 = _mm_setzero_pd();
+    __m128d peak1 = _mm_setzero_pd();
+    for (; s + 4 <= numSamples; s += 4) {
+      peak0 = _mm_max_pd(peak0, _mm_and_pd(_mm_loadu_pd(samples + s), absMask));
+      peak1 = _mm_max_pd(peak1, _mm_and_pd(_mm_loadu_pd(samples + s + 2), absMask));
+    }
+    peak0 = _mm_max_pd(peak0, peak1);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, peak0);
+    peak = std::max(lanes[0], lanes[1]);
+#endif
+
+    for (; s < numSamples; ++s) {
+      peak = std::max(peak, fabs(samples[s]));
+    }
+    return peak;
+  }
+
+  // Widens [minValue, maxValue] to take in a run of samples
+  inline void minMax(const float* samples, ulong numSamples, float& minValue, float& maxValue) {
+    ulong s = 0;
+
+#if AUDIO_KERNELS_SSE2
+    if (numSamples >= 8) {
+      __m128 min0 = _mm_set1_ps(minValue);
+      __m128 max0 = _mm_set1_ps(maxValue);
+      __m128 min1 = min0;
+      __m128 max1 = max0;
+      for (; s + 8 <= numSamples; s += 8) {
+        __m128 samples0 = _mm_loadu_ps(samples + s);
+        __m128 samples1 = _mm_loadu_ps(samples + s + 4);
+        min0 = _mm_min_ps(min0, samples0);
+        max0 = _mm_max_ps(max0, samples0);
+        min1 = _mm_min_ps(min1, samples1);
+        max1 = _mm_max_ps(max1, samples1);
+      }
+      min0 = _mm_min_ps(min0, min1);
+      max0 = _mm_max_ps(max0, max1);
+
+      float lanes[4];
+      _mm_storeu_ps(lanes, min0);
+      minValue = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+      _mm_storeu_ps(lanes, max0);
+      maxValue = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+#endif
+
+    for (; s < numSamples; ++s) {
+      minValue = std::min(minValue, samples[s]);
+      maxValue = std::max(maxValue, samples[s]);
+    }
+  }
+
+  inline void minMax(const double* samples, ulong numSamples, double& minValue, double& maxValue) {
+    ulong s = 0;
+
+#if AUDIO_KERNELS_SSE2
+    if (numSamples >= 4) {
+      __m128d min0 = _mm_set1_pd(minValue);
+      __m128d max0 = _mm_set1_pd(maxValue);
+      __m128d min1 = min0;
+      __m128d max1 = max0;
+      for (; s + 4 <= numSamples; s += 4) {
+        __m128d samples0 = _mm_loadu_pd(samples + s);
+        __m128d samples1 = _mm_loadu_pd(samples + s + 2);
+        min0 = _mm_min_pd(min0, samples0);
+        max0 = _mm_max_pd(max0, samples0);
+        min1 = _mm_min_pd(min1, samples1);
+        max1 = _mm_max_pd(max1, samples1);
+      }
+      min0 = _mm_min_pd(min0, min1);
+      max0 = _mm_max_pd(max0, max1);
+
+      double lanes[2];
+      _mm_storeu_pd(lanes, min0);
+      minValue = std::min(lanes[0], lanes[1]);
+      _mm_storeu_pd(lanes, max0);
+      maxValue = std::max(lanes[0], lanes[1]);
+    }
+#endif
+
+    for (; s < numSamples; ++s) {
+      minValue = std::min(minValue, samples[s]);
+      maxValue = std::max(maxValue, samples[s]);
+    }
+  }
+
+  // Sum of the squares of a run of samples, accumulated in double so long
+  // renders don't lose precision
+  inline double sumSquares(const float* samples, ulong numSamples) {
+    ulong s = 0;
+    double sum = 0.0;
+
+#if AUDIO_KERNELS_SSE2
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    for (; s + 4 <= numSamples; s += 4) {
+      __m128 squares = _mm_loadu_ps(samples + s);
+      squares = _mm_mul_ps(squares, squares);
+      sum0 = _mm_add_pd(sum0, _mm_cvtps_pd(squares));
+      sum1 = _mm_add_pd(sum1, _mm_cvtps_pd(_mm_movehl_ps(squares, squares)));
+    }
+    sum0 = _mm_add_pd(sum0, sum1);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum0);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; s < numSamples; ++s) {
+      sum += static_cast<double>(samples[s]) * samples[s];
+    }
+    return sum;
+  }
+
+  inline double sumSquares(const double* samples, ulong numSamples) {
+    ulong s = 0;
+    double sum = 0.0;
+
+#if AUDIO_KERNELS_SSE2
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    for (; s + 4 <= numSamples; s += 4) {
+      __m128d squares0 = _mm_loadu_pd(samples + s);
+      __m128d squares1 = _mm_loadu_pd(samples + s + 2);
+      sum0 = _mm_add_pd(sum0, _mm_mul_pd(squares0, squares0));
+      sum1 = _mm_add_pd(sum1, _mm_mul_pd(squares1, squares1));
+    }
+    sum0 = _mm_add_pd(sum0, sum1);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum0);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; s < numSamples; ++s) {
+      sum += samples[s] * samples[s];
+    }
+    return sum;
+  }
+
+  // Frames interleaved at a time on the channel-outer path; small enough that
+  // the tile of output being filled in stays in L1 even for wide buses
+  constexpr ulong kInterleaveTileFrames = 64;
+
+  // A packed 24-bit PCM sample
+  struct Pcm24 {
+    uchar bytes[3];
+  };
+
+  // Data from the VST SDK is channel sequential (channel 1 bufsize samples, channel 2 bufsize samples, ..., channel N bufsize samples)
+  // PCM is encoded as channel-interleaved (channel 1,2,...,N sample 0, channel 1,2,...,N sample 1, ..., channel 1,2,...,N sample bufsize)
+  // This interleaves the data, converting each sample with encode(sample, out). Pass
+  // kChannels to fix the channel count at compile time; numChannels is then
+  // ignored.
+  template <ushort kChannels, typename T, typename Out, typename Encode>
+  inline void interleave(const T* const* channels, ushort numChannels, ulong numFrames, Out* out, Encode encode) {
+    if constexpr (kChannels != kDynamicChannels) {
+      // Known, small channel count: the channel loop unrolls and the output
+      // is written in order
+      for (ulong s = 0; s < numFrames; ++s) {
+        for (ushort c = 0; c < kChannels; ++c) {
+          encode(channels[c][s], *out++);
+        }
+      }
+    }
+    else {
+      // Any channel count: one channel at a time, so each channel pointer is
+      // loaded once per tile rather than once per sample, and each inner
+      // loop reads one contiguous run
+      for (ulong tileStart = 0; tileStart < numFrames; tileStart += kInterleaveTileFrames) {
+        ulong tileFrames = std::min(kInterleaveTileFrames, numFrames - tileStart);
+        Out* tileOut = out + (tileStart * numChannels);
+        for (ushort c = 0; c < numChannels; ++c) {
+          const T* in = channels[c] + tileStart;
+          Out* channelOut = tileOut + c;
+          for (ulong s = 0; s < tileFrames; ++s) {
+            encode(in[s], channelOut[s * numChannels]);
+          }
+        }
+      }
+    }
+  }
+
+  // Incoming values from VST are [-1.0,1.0] and maxValue is the largest value
+  // of a PCM sample. T is float or double, depending on which precision the
+  // plugin processed in.
+
+  // 8-bit PCM samples are [0,255] - the only unsigned bit depth
+  template <ushort kChannels = kDynamicChannels, typename T> inline void encodePcm8(const T* const* channels, ushort numChannels,
+    ulong numFrames, double maxValue, uchar* out) {
+    interleave<kChannels>(channels, numChannels, numFrames, out, [maxValue](T sample, uchar& pcm) {
+      pcm = static_cast<uchar>((sample + static_cast<T>(1.0)) * maxValue);
+    });
+  }
+
+  // All other bit depths are standard two's complement signed
+  template <ushort kChannels = kDynamicChannels, typename T> inline void encodePcm16(const T* const* channels, ushort numChannels,
+    ulong numFrames, double maxValue, short* out) {
+    interleave<kChannels>(channels, numChannels, numFrames, out, [maxValue](T sample, short& pcm) {
+      pcm = static_cast<short>(sample * maxValue);
+    });
+  }
+
+  template <ushort kChannels = kDynamicChannels, typename T> inline void encodePcm24(const T* const* channels, ushort numChannels,
+    ulong numFrames, double maxValue, uchar* out) {
+    interleave<kChannels>(channels, numChannels, numFrames, reinterpret_cast<Pcm24*>(out), [maxValue](T sample, Pcm24& pcm) {
+      int sampleAsInt = static_cast<int>(sample * maxValue);
+
+      pcm.bytes[0] = static_cast<uchar>((sampleAsInt) & 0xFF);
+      pcm.bytes[1] = static_cast<uchar>((sampleAsInt >> 8) & 0xFF);
+      pcm.bytes[2] = static_cast<uchar>((sampleAsInt >> 16) & 0xFF);
+    });
+  }
+
+  template <ushort kChannels = kDynamicChannels, typename T> inline void encodePcm32(const T* const* channels, ushort numChannels,
+    ulong numFrames, double maxValue, int* out) {
+    interleave<kChannels>(channels, numChannels, numFrames, out, [maxValue](T sample, int& pcm) {
+      pcm = static_cast<int>(sample * maxValue);
+    });
+  }
+
+  // IEEE float output is just interleaved
+  template <ushort kChannels = kDynamicChannels, typename T> inline void encodeFloat32(const T* const* channels, ushort numChannels,
+    ulong numFrames, float* out) {
+    interleave<kChannels>(channels, numChannels, numFrames, out, [](T sample, float& pcm) {
+      pcm = static_cast<float>(sample);
+    });
+  }
+
+  // Multiplies a run of samples by gain in place
+  inline void scale(float* samples, size_t numSamples, float gain) {
+    size_t s = 0;
+
+#if AUDIO_KERNELS_SSE2
+    const __m128 gains = _mm_set1_ps(gain);
+    for (; s + 8 <= numSamples; s += 8) {
+      _mm_storeu_ps(samples + s, _mm_mul_ps(_mm_loadu_ps(samples + s), gains));
+      _mm_storeu_ps(samples + s + 4, _mm_mul_ps(_mm_loadu_ps(samples + s + 4), gains));
+    }
+#endif
+
+    for (; s < numSamples; ++s) {
+      samples[s] *= gain;
+    }
+  }
+
+  // Decibels (full scale) to linear gain
+  inline float dbToGain(float db) {
+    return powf(10.0f, db / 20.0f);
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <type_traits>
+#include "Types.h"
+
+// Channel counts can be fixed at compile time so per-sample loops over
+// channels unroll (and interleaving vectorizes). kDynamicChannels leaves the
+// count to run time, for layouts we haven't specialized.
+constexpr ushort kDynamicChannels = 0;
+
+template <ushort kChannels> using ChannelCount = std::integral_constant<ushort, kChannels>;
+
+// The number of channels to loop over: the compile time count if there is one
+template <ushort kChannels> constexpr ushort resolveChannelCount(ushort numChannels) {
+  return kChannels == kDynamicChannels ? numChannels : kChannels;
+}
+
+// Calls func(ChannelCount<N>()) with the specialization for numChannels, or
+// with kDynamicChannels if there isn't one. Done once per session; everything
+// below it is then compiled for that count.
+template <typename Func> void dispatchChannelCount(ushort numChannels, Func&& func) {
+  switch (numChannels) {
+    case 1:
+      func(ChannelCount<1>());
+      break;
+    case 2:
+      func(ChannelCount<2>());
+      break;
+    case 8:
+      func(ChannelCount<8>());
+      break;
+    default:
+      func(ChannelCount<kDynamicChannels>());
+      break;
+  }
+}
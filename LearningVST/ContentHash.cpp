@@ -0,0 +1,71 @@
+#include "ContentHash.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "Json.h"
+
+ContentHash::ContentHash(ulong segmentFrames, uint bytesPerFrame) {
+  this->segmentFrames = std::max(segmentFrames, static_cast<ulong>(1));
+  this->bytesPerFrame = bytesPerFrame;
+  this->segmentBytes = static_cast<uint64_t>(this->segmentFrames) * bytesPerFrame;
+  segmentDigests.reserve(kReservedSegments);
+}
+
+void ContentHash::update(const uchar* data, size_t numBytes) {
+  hash.update(data, numBytes);
+  this->numBytes += numBytes;
+
+  // Split wherever a segment ends
+  while (numBytes > 0) {
+    size_t segmentPart = static_cast<size_t>(std::min(static_cast<uint64_t>(numBytes),
+      segmentBytes - bytesInSegment));
+    segmentHash.update(data, segmentPart);
+    bytesInSegment += segmentPart;
+    data += segmentPart;
+    numBytes -= segmentPart;
+
+    if (bytesInSegment == segmentBytes) {
+      segmentDigests.push_back(segmentHash.digest());
+      segmentHash.reset();
+      bytesInSegment = 0;
+    }
+  }
+}
+
+std::vector<uint64_t> ContentHash::getSegmentDigests() const {
+  auto digests = segmentDigests;
+  if (bytesInSegment > 0) {
+    digests.push_back(segmentHash.digest());
+  }
+  return digests;
+}
+
+bool ContentHash::writeJson(const std::string& fileName, const std::string& audioFileName, uint sampleRate) const {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create hash file " << fileName << std::endl;
+    return false;
+  }
+
+  auto digests = getSegmentDigests();
+
+  ofs << "{" << std::endl;
+  ofs << "  \"file\": \"" << escapeJson(audioFileName) << "\"," << std::endl;
+  ofs << "  \"algorithm\": \"xxh64\"," << std::endl;
+  ofs << "  \"dataBytes\": " << numBytes << "," << std::endl;
+  ofs << "  \"digest\": \"" << Xxh64::toString(getDigest()) << "\"," << std::endl;
+  ofs << "  \"segmentFrames\": " << segmentFrames << "," << std::endl;
+  ofs << "  \"segmentSeconds\": " << static_cast<double>(segmentFrames) / sampleRate << "," << std::endl;
+  ofs << "  \"segments\": [" << std::endl;
+  for (size_t i = 0; i < digests.size(); ++i) {
+    ofs << "    \"" << Xxh64::toString(digests[i]) << "\"" << (i + 1 < digests.size() ? "," : "") << std::endl;
+  }
+  ofs << "  ]" << std::endl;
+  ofs << "}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing hash file " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "Types.h"
+#include "Xxh64.h"
+
+// XXH64 of the audio data exactly as it ends up in the file, plus one digest
+// per fixed-length segment. Renders can then be compared (or deduplicated) by
+// digest instead of by diffing WAV files, and when two differ the segment
+// digests say where without reading any audio back.
+class ContentHash {
+public:
+  // Room for this many segments up front, so hashing doesn't allocate while
+  // rendering (a few hours at the default segment length)
+  static constexpr size_t kReservedSegments = 2048;
+
+protected:
+  ulong segmentFrames;
+  uint bytesPerFrame;
+  uint64_t segmentBytes;
+
+  Xxh64 hash;
+  Xxh64 segmentHash;
+  uint64_t bytesInSegment = 0;
+  uint64_t numBytes = 0;
+  std::vector<uint64_t> segmentDigests; // Completed segments
+
+public:
+  ContentHash(ulong segmentFrames, uint bytesPerFrame);
+
+  // The next numBytes of the data chunk; they don't have to line up with
+  // frames or segments
+  void update(const uchar* data, size_t numBytes);
+
+  inline uint64_t getDigest() const {
+    return hash.digest();
+  }
+
+  // Every segment, including the last, partial one
+  std::vector<uint64_t> getSegmentDigests() const;
+
+  inline uint64_t getNumBytes() const {
+    return numBytes;
+  }
+
+  // Sidecar for audioFileName: the digests as JSON
+  bool writeJson(const std::string& fileName, const std::string& audioFileName, uint sampleRate) const;
+};
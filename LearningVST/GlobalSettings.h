@@ -4,12 +4,13 @@
 
 // Singleton. Use GlobalSettings::get() to get the instance
 class GlobalSettings {
-  static constexpr ulong kDefaultBlockSize = 512;
+  static constexpr ulong kDefaultBlockSize = 4096;
   static constexpr ushort kDefaultNumChannels = 2;
   static constexpr double kDefaultSampleRate = 44100.0;
   static constexpr double kDefaultTempo = 120.0;
   static constexpr ushort kDefaultBeatsPerMeasure = 4;
   static constexpr ushort kDefaultNoteValue = 4;
+  static constexpr ulong kDefaultMaxEventsPerBlock = 1024;
 
 protected:
   ulong blockSize = kDefaultBlockSize;
@@ -18,6 +19,7 @@ protected:
   double tempo = kDefaultTempo;
   ushort beatsPerMeasure = kDefaultBeatsPerMeasure;
   ushort noteValue = kDefaultNoteValue;
+  ulong maxEventsPerBlock = kDefaultMaxEventsPerBlock;
 
   GlobalSettings() {
 
@@ -35,6 +37,14 @@ public:
     return blockSize;
   }
 
+  // Capacity of the per-block event buffers, which are allocated once up front
+  inline void setMaxEventsPerBlock(ulong maxEventsPerBlock) {
+    this->maxEventsPerBlock = maxEventsPerBlock;
+  }
+  inline ulong getMaxEventsPerBlock() const {
+    return maxEventsPerBlock;
+  }
+
   inline void setNumChannels(ushort numChannels) {
     this->numChannels = numChannels;
   }
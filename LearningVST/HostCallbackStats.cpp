@@ -0,0 +1,166 @@
+#include "HostCallbackStats.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include "Json.h"
+#include "RealtimeLog.h"
+
+const char* HostCallbackStats::getOpcodeName(int opCode) {
+  // In opcode order, deprecated ones included since old plugins still call them
+  static const char* const names[kNumOpcodes] = {
+    "audioMasterAutomate",
+    "audioMasterVersion",
+    "audioMasterCurrentId",
+    "audioMasterIdle",
+    "audioMasterPinConnected",
+    "audioMasterUnused5",
+    "audioMasterWantMidi",
+    "audioMasterGetTime",
+    "audioMasterProcessEvents",
+    "audioMasterSetTime",
+    "audioMasterTempoAt",
+    "audioMasterGetNumAutomatableParameters",
+    "audioMasterGetParameterQuantization",
+    "audioMasterIOChanged",
+    "audioMasterNeedIdle",
+    "audioMasterSizeWindow",
+    "audioMasterGetSampleRate",
+    "audioMasterGetBlockSize",
+    "audioMasterGetInputLatency",
+    "audioMasterGetOutputLatency",
+    "audioMasterGetPreviousPlug",
+    "audioMasterGetNextPlug",
+    "audioMasterWillReplaceOrAccumulate",
+    "audioMasterGetCurrentProcessLevel",
+    "audioMasterGetAutomationState",
+    "audioMasterOfflineStart",
+    "audioMasterOfflineRead",
+    "audioMasterOfflineWrite",
+    "audioMasterOfflineGetCurrentPass",
+    "audioMasterOfflineGetCurrentMetaPass",
+    "audioMasterSetOutputSampleRate",
+    "audioMasterGetOutputSpeakerArrangement",
+    "audioMasterGetVendorString",
+    "audioMasterGetProductString",
+    "audioMasterGetVendorVersion",
+    "audioMasterVendorSpecific",
+    "audioMasterSetIcon",
+    "audioMasterCanDo",
+    "audioMasterGetLanguage",
+    "audioMasterOpenWindow",
+    "audioMasterCloseWindow",
+    "audioMasterGetDirectory",
+    "audioMasterUpdateDisplay",
+    "audioMasterBeginEdit",
+    "audioMasterEndEdit",
+    "audioMasterOpenFileSelector",
+    "audioMasterCloseFileSelector",
+    "audioMasterEditFile",
+    "audioMasterGetChunkFile",
+    "audioMasterGetInputSpeakerArrangement",
+  };
+
+  if (opCode >= 0 && opCode < kNumOpcodes) {
+    return names[opCode];
+  }
+  return "audioMasterUnknown";
+}
+
+void HostCallbackStats::noteUnhandled(int opCode) {
+  if (!opcodes[getSlot(opCode)].reportedUnhandled.exchange(true, std::memory_order_relaxed)) {
+    RealtimeLog::get().log("Plugin called unhandled host opcode %s (%d)", getOpcodeName(opCode), opCode);
+  }
+}
+
+// Busiest first; opcodes that were never called are left out
+static std::vector<size_t> getCalledSlots(const std::array<uint64_t, HostCallbackStats::kNumOpcodes + 1>& counts) {
+  std::vector<size_t> slots;
+  for (size_t slot = 0; slot < counts.size(); ++slot) {
+    if (counts[slot] > 0) {
+      slots.push_back(slot);
+    }
+  }
+  std::stable_sort(slots.begin(), slots.end(), [&counts](size_t a, size_t b) { return counts[a] > counts[b]; });
+  return slots;
+}
+
+void HostCallbackStats::printReport(std::ostream& os, const std::string& pluginName, ulong numProcessCalls) const {
+  std::array<uint64_t, kNumOpcodes + 1> counts;
+  for (size_t slot = 0; slot < counts.size(); ++slot) {
+    counts[slot] = opcodes[slot].count.load(std::memory_order_relaxed);
+  }
+
+  auto flags = os.flags();
+  auto precision = os.precision();
+
+  os << "Host callbacks from " << pluginName << " over " << numProcessCalls << " process calls:" << std::endl;
+  os << "  " << std::left << std::setw(40) << "opcode" << std::right << std::setw(10) << "calls" <<
+    std::setw(12) << "per block";
+  if (timing) {
+    os << std::setw(12) << "total us" << std::setw(10) << "mean ns" << std::setw(10) << "max ns";
+  }
+  os << std::endl;
+
+  os << std::fixed;
+  for (size_t slot : getCalledSlots(counts)) {
+    const OpcodeStats& stats = opcodes[slot];
+    os << "  " << std::left << std::setw(40) << getOpcodeName(static_cast<int>(slot)) << std::right <<
+      std::setw(10) << counts[slot] << std::setprecision(2) << std::setw(12) <<
+      (numProcessCalls > 0 ? static_cast<double>(counts[slot]) / numProcessCalls : 0.0);
+    if (timing) {
+      uint64_t nanoseconds = stats.nanoseconds.load(std::memory_order_relaxed);
+      os << std::setprecision(1) << std::setw(12) << nanoseconds / 1000.0 <<
+        std::setprecision(0) << std::setw(10) << static_cast<double>(nanoseconds) / counts[slot] <<
+        std::setw(10) << stats.maxNanoseconds.load(std::memory_order_relaxed);
+    }
+    os << std::endl;
+  }
+
+  os.flags(flags);
+  os.precision(precision);
+}
+
+bool HostCallbackStats::writeJson(const std::string& fileName, const std::string& pluginName,
+  ulong numProcessCalls) const {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create host callback report " << fileName << std::endl;
+    return false;
+  }
+
+  std::array<uint64_t, kNumOpcodes + 1> counts;
+  for (size_t slot = 0; slot < counts.size(); ++slot) {
+    counts[slot] = opcodes[slot].count.load(std::memory_order_relaxed);
+  }
+  auto slots = getCalledSlots(counts);
+
+  ofs << std::fixed << std::setprecision(3);
+  ofs << "{" << std::endl;
+  ofs << "  \"plugin\": \"" << escapeJson(pluginName) << "\"," << std::endl;
+  ofs << "  \"numProcessCalls\": " << numProcessCalls << "," << std::endl;
+  ofs << "  \"timed\": " << (timing ? "true" : "false") << "," << std::endl;
+  ofs << "  \"opcodes\": [" << std::endl;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    size_t slot = slots[i];
+    const OpcodeStats& stats = opcodes[slot];
+    ofs << "    { \"opcode\": " << (slot < kNumOpcodes ? static_cast<int>(slot) : -1) <<
+      ", \"name\": \"" << getOpcodeName(static_cast<int>(slot)) << "\"" <<
+      ", \"calls\": " << counts[slot] <<
+      ", \"callsPerBlock\": " << (numProcessCalls > 0 ? static_cast<double>(counts[slot]) / numProcessCalls : 0.0);
+    if (timing) {
+      ofs << ", \"totalUs\": " << stats.nanoseconds.load(std::memory_order_relaxed) / 1000.0 <<
+        ", \"maxNs\": " << stats.maxNanoseconds.load(std::memory_order_relaxed);
+    }
+    ofs << " }" << (i + 1 < slots.size() ? "," : "") << std::endl;
+  }
+  ofs << "  ]" << std::endl;
+  ofs << "}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing host callback report " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
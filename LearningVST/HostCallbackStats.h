@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <ostream>
+#include <stdint.h>
+#include "Types.h"
+
+// How often, and for how long, a plugin calls back into the host, by
+// audioMaster opcode; some call audioMasterGetTime several times a block.
+// Plugins can call from any thread, so everything's atomic. Calls are always
+// counted; timing them is opt-in.
+class HostCallbackStats {
+public:
+  // One past the last VST 2.4 audioMaster opcode; anything higher is counted
+  // in the last slot
+  static constexpr int kNumOpcodes = 50;
+
+protected:
+  struct OpcodeStats {
+    std::atomic<uint64_t> count { 0 };
+    std::atomic<uint64_t> nanoseconds { 0 };
+    std::atomic<uint64_t> maxNanoseconds { 0 };
+    std::atomic<bool> reportedUnhandled { false };
+  };
+
+  std::array<OpcodeStats, kNumOpcodes + 1> opcodes;
+  bool timing = false;
+
+  HostCallbackStats() {
+  }
+
+  static inline size_t getSlot(int opCode) {
+    return opCode >= 0 && opCode < kNumOpcodes ? static_cast<size_t>(opCode) : kNumOpcodes;
+  }
+
+public:
+  static HostCallbackStats& get() {
+    static HostCallbackStats hostCallbackStats;
+    return hostCallbackStats;
+  }
+
+  // audioMasterGetTime and so on; "audioMasterUnknown" outside VST 2.4
+  static const char* getOpcodeName(int opCode);
+
+  inline void setTiming(bool timing) {
+    this->timing = timing;
+  }
+
+  inline bool isTiming() const {
+    return timing;
+  }
+
+  inline void count(int opCode) {
+    opcodes[getSlot(opCode)].count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inline void recordTime(int opCode, uint64_t nanoseconds) {
+    OpcodeStats& stats = opcodes[getSlot(opCode)];
+    stats.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t maxNanoseconds = stats.maxNanoseconds.load(std::memory_order_relaxed);
+    while (nanoseconds > maxNanoseconds &&
+      !stats.maxNanoseconds.compare_exchange_weak(maxNanoseconds, nanoseconds, std::memory_order_relaxed)) {
+    }
+  }
+
+  // For opcodes we don't answer; says so the first time each one comes up
+  void noteUnhandled(int opCode);
+
+  // numProcessCalls gives the calls per block
+  void printReport(std::ostream& os, const std::string& pluginName, ulong numProcessCalls) const;
+  bool writeJson(const std::string& fileName, const std::string& pluginName, ulong numProcessCalls) const;
+};
+
+// Counts a host callback, and times it if asked to
+class HostCallbackScope {
+protected:
+  int opCode;
+  uint64_t start = 0;
+
+  static inline uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+public:
+  inline HostCallbackScope(int opCode) {
+    this->opCode = opCode;
+    HostCallbackStats::get().count(opCode);
+    if (HostCallbackStats::get().isTiming()) {
+      start = now();
+    }
+  }
+
+  HostCallbackScope(const HostCallbackScope&) = delete;
+  HostCallbackScope& operator=(const HostCallbackScope&) = delete;
+
+  inline ~HostCallbackScope() {
+    if (start != 0) {
+      HostCallbackStats::get().recordTime(opCode, now() - start);
+    }
+  }
+};
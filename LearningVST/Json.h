@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// For the sidecar files we write by hand: s as the inside of a JSON string.
+// File names are the only free text that ends up in them, so quotes and
+// Windows path separators are all that need escaping.
+inline std::string escapeJson(const std::string& s) {
+  std::string escaped;
+  escaped.reserve(s.size());
+  for (char c : s) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+// The first entry of a render's sidecars: "file", the WAV file it describes,
+// or with stems "stems", each stem's file in channel order (the sidecar then
+// covers the whole bus, not any one of them)
+inline void writeJsonAudioFiles(std::ostream& os, const std::vector<std::string>& audioFileNames) {
+  if (audioFileNames.size() == 1) {
+    os << "  \"file\": \"" << escapeJson(audioFileNames[0]) << "\"," << std::endl;
+    return;
+  }
+  os << "  \"stems\": [";
+  for (size_t i = 0; i < audioFileNames.size(); ++i) {
+    os << (i > 0 ? ", " : "") << "\"" << escapeJson(audioFileNames[i]) << "\"";
+  }
+  os << "]," << std::endl;
+}
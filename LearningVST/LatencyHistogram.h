@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <algorithm>
+#include "Types.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// HDR-style histogram of durations in nanoseconds: buckets are linear within
+// each power of two, so every value is kept to within 1/kSubBuckets (about
+// 3%) from 1ns up to the full 64-bit range, in a fixed amount of memory.
+// Recording is a few instructions and never allocates.
+class LatencyHistogram {
+public:
+  static constexpr uint kSubBucketBits = 5;
+  static constexpr uint kSubBuckets = 1 << kSubBucketBits;
+  static constexpr uint kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+protected:
+  std::array<uint64_t, kNumBuckets> counts = { };
+  uint64_t count = 0;
+  uint64_t total = 0;
+  uint64_t maxValue = 0;
+
+  static inline uint getHighestBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanReverse64(&bit, value);
+    return bit;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+
+  // Values below kSubBuckets get a bucket each; above that, each power of
+  // two is split into kSubBuckets
+  static inline uint getBucket(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<uint>(value);
+    }
+    uint shift = getHighestBit(value) - kSubBucketBits;
+    return ((shift + 1) * kSubBuckets) + static_cast<uint>((value >> shift) - kSubBuckets);
+  }
+
+  // Largest value that lands in a bucket
+  static inline uint64_t getBucketHighestValue(uint bucket) {
+    uint group = bucket / kSubBuckets;
+    uint64_t subBucket = bucket % kSubBuckets;
+    if (group == 0) {
+      return subBucket;
+    }
+    uint shift = group - 1;
+    return (((kSubBuckets + subBucket + 1) << shift) - 1);
+  }
+
+public:
+  inline void record(uint64_t value) {
+    ++counts[getBucket(value)];
+    ++count;
+    total += value;
+    maxValue = std::max(maxValue, value);
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (uint bucket = 0; bucket < kNumBuckets; ++bucket) {
+      counts[bucket] += other.counts[bucket];
+    }
+    count += other.count;
+    total += other.total;
+    maxValue = std::max(maxValue, other.maxValue);
+  }
+
+  inline uint64_t getCount() const {
+    return count;
+  }
+
+  inline uint64_t getTotal() const {
+    return total;
+  }
+
+  inline uint64_t getMax() const {
+    return maxValue;
+  }
+
+  // Value at or below which percentile% of the recorded values fall, to the
+  // histogram's precision (never more than the real maximum)
+  uint64_t getPercentile(double percentile) const {
+    if (count == 0) {
+      return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>((percentile / 100.0) * static_cast<double>(count) + 0.5);
+    rank = std::min(std::max(rank, static_cast<uint64_t>(1)), count);
+
+    uint64_t seen = 0;
+    for (uint bucket = 0; bucket < kNumBuckets; ++bucket) {
+      seen += counts[bucket];
+      if (seen >= rank) {
+        return std::min(getBucketHighestValue(bucket), maxValue);
+      }
+    }
+    return maxValue;
+  }
+};
@@ -6,18 +6,41 @@
 #include <string>
 #include <filesystem>
 #include <assert.h>
+#include <stdio.h>
+#include <limits.h>
+#include <chrono>
+#include <memory>
 #include "MidiSource.h"
 #include "AudioClock.h"
 #include "GlobalSettings.h"
+#include "ChannelCount.h"
 #include "SampleBuffer.h"
 #include "PcmWavFile.h"
-
-// GFlags
+#include "SilenceDetector.h"
+#include "NoteTracker.h"
+#include "Span.h"
+#include "AllocationCounter.h"
+#include "VstEventRing.h"
+#include "AudioBufferArena.h"
+#include "StemWriter.h"
+#include "AudioAnalyzer.h"
+#include "RenderProfiler.h"
+#include "TraceRecorder.h"
+#include "HostCallbackStats.h"
+#include "RealtimeLog.h"
+#include "RealtimeChecker.h"
+#include "ReferenceInstrument.h"
+#include "PluginLibrary.h"
+
+// GFlags; the copy checked in here is the Windows build's
+#ifdef _WIN32
 #include "gflags/gflags.h"
+#else
+#include <gflags/gflags.h>
+#endif
 
 // VST2.X SDK
-#define VST_FORCE_DEPRECATED 0 // TODO: See if we really need to do this
-#include "aeffectx.h"
+#include "VstSdk.h"
 
 static const std::string kVendorName("Dry Cactus");
 static const std::string kProgramName("LearningVST");
@@ -25,9 +48,6 @@ static unsigned int kVersionMajor = 0;
 static unsigned int kVersionMinor = 1;
 static unsigned int kVersionPatch = 0;
 
-// Need a global instance b/c it is passed by pointer via callbacks
-VstTimeInfo vstTimeInfo = { };
-
 // VST2.X callbacks
 typedef AEffect *(*Vst2xPluginEntryFunc)(audioMasterCallback host);
 typedef VstIntPtr (*Vst2xPluginDispatcherFunc)(AEffect *effect, VstInt32 opCode, VstInt32 index, VstIntPtr value, void *ptr, float opt);
@@ -39,6 +59,8 @@ extern "C" {
 }
 
 VstIntPtr VSTCALLBACK pluginVst2xHostCallback(AEffect *effect, VstInt32 opCode, VstInt32 index, VstIntPtr value, void *dataPtr, float opt) {
+  HostCallbackScope hostCallbackScope(opCode);
+  TraceScope traceScope(HostCallbackStats::getOpcodeName(opCode), "opcode", opCode);
   VstIntPtr result = 0;
 
   switch (opCode) {
@@ -80,87 +102,19 @@ VstIntPtr VSTCALLBACK pluginVst2xHostCallback(AEffect *effect, VstInt32 opCode,
       result = kVstProcessLevelUnknown;
       break;
 
-    case audioMasterGetTime: {
-      auto& audioClock = AudioClock::get();
-
-      vstTimeInfo.samplePos = audioClock.getCurrentFrame();
-      vstTimeInfo.sampleRate = GlobalSettings::get().getSampleRate();
-
-      // Set flags for transport state
-      vstTimeInfo.flags = 0;
-      if (audioClock.getTransportChanged()) {
-        vstTimeInfo.flags |= kVstTransportChanged;
-      }
-      if (audioClock.getIsPlaying()) {
-        vstTimeInfo.flags |= kVstTransportPlaying;
-      }
-
-      // See what other info was requested. Note that I'm only mentioning
-      // ones we actually handle, which could result in some unlogged cases.
-      // TODO: add logging for requested data which we do not support
-
-      if (value & kVstNanosValid) {
-        // Oh boy ... we want to be running real-time, seems we should implement this ...
-      }
-      if (value & kVstPpqPosValid) {
-        vstTimeInfo.ppqPos = audioClock.getPpqPos();
-        vstTimeInfo.flags |= kVstPpqPosValid;
-      }
-      if (value & kVstTempoValid) {
-        vstTimeInfo.tempo = GlobalSettings::get().getTempo();
-        vstTimeInfo.flags |= kVstTempoValid;
-      }
-      if (value & kVstBarsValid) {
-        // Misbehaving plugins ...
-        if (!(value & kVstPpqPosValid)) {
-          std::cerr << "Plugin requested position in bars but not PPQ; calculation will be invalid" << std::endl;
-        }
-
-        vstTimeInfo.barStartPos = audioClock.getBarStartPos(vstTimeInfo.ppqPos);
-        vstTimeInfo.flags |= kVstBarsValid;
-      }
-      if (value & kVstTimeSigValid) {
-        vstTimeInfo.timeSigNumerator = GlobalSettings::get().getBeatsPerMeasure();
-        vstTimeInfo.timeSigDenominator = GlobalSettings::get().getNoteValue();
-        vstTimeInfo.flags |= kVstTimeSigValid;
-      }
+    case audioMasterGetTime:
+      // Worked out once per block by AudioClock; we hand out every field we
+      // support whatever was asked for in value, which the spec allows
+      result = reinterpret_cast<VstIntPtr>(const_cast<VstTimeInfo*>(AudioClock::get().getTimeInfo()));
+      break;
 
-      result = reinterpret_cast<VstIntPtr>(&vstTimeInfo);
+    default:
+      HostCallbackStats::get().noteUnhandled(opCode);
       break;
-    }
   }
   return result;
 }
 
-// Helper function to convert GetLastError code to std::string
-std::string GetLastErrorString()
-{
-  DWORD error = GetLastError();
-  if (error)
-  {
-    LPVOID lpMsgBuf;
-    DWORD bufLen = FormatMessage(
-      FORMAT_MESSAGE_ALLOCATE_BUFFER |
-      FORMAT_MESSAGE_FROM_SYSTEM |
-      FORMAT_MESSAGE_IGNORE_INSERTS,
-      NULL,
-      error,
-      MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-      (LPTSTR)&lpMsgBuf,
-      0, NULL);
-    if (bufLen)
-    {
-      LPCSTR lpMsgStr = (LPCSTR)lpMsgBuf;
-      std::string result(lpMsgStr, lpMsgStr + bufLen);
-
-      LocalFree(lpMsgBuf);
-
-      return result;
-    }
-  }
-  return std::string();
-}
-
 enum class VstPluginType {
   Unknown,
   Effect,
@@ -169,8 +123,15 @@ enum class VstPluginType {
 
 class VstPlugin {
 public:
+  // Blocks timed at each precision when choosing between them, how many
+  // times each precision is timed (the best time counts), and how much faster
+  // double has to be to be chosen over single
+  static constexpr uint kPrecisionBenchmarkBlocks = 16;
+  static constexpr uint kPrecisionBenchmarkRuns = 4;
+  static constexpr double kDoublePrecisionMargin = 0.9;
+
   enum class Setting {
-    TailTimeInMs,
+    TailFrames,
     NumInputs,
     NumOutputs,
     InitialDelay,
@@ -179,20 +140,23 @@ protected:
   VstPluginType type = VstPluginType::Unknown;
   std::string name;
   std::string absolutePath;
-  HMODULE handle;
-  AEffect *plugin;
-  std::vector<uchar> vstEventsBuffer; // Buffer for the memory for the VstEvents struct and the array(s) of VstEvent structs
+  PluginLibrary library;
+  AEffect *plugin = nullptr;
+  VstEventRing eventRing; // Memory for the VstEvents we send, kept alive until the plugin is done with it
+  ulong numProcessCalls = 0;
 
-  void setupSpeakers(VstSpeakerArrangement& speakerArrangement, int numChannels) {
-    memset(&speakerArrangement, 0, sizeof(speakerArrangement));
+  // VstSpeakerArrangement only has room for 8 speakers; wider arrangements
+  // are passed as the same struct with a longer speakers array
+  std::vector<uchar> inputSpeakerMemory;
+  std::vector<uchar> outputSpeakerMemory;
 
-    if (numChannels <= 8) {
-      speakerArrangement.numChannels = numChannels;
-    }
-    else {
-      std::cerr << "Unable to configure more than 8 speakers" << std::endl;
-      speakerArrangement.numChannels = 8;
-    }
+  VstSpeakerArrangement* setupSpeakers(std::vector<uchar>& memory, int numChannels) {
+    static constexpr int kFixedSpeakers = 8;
+    int numExtraSpeakers = std::max(numChannels - kFixedSpeakers, 0);
+    memory.assign(sizeof(VstSpeakerArrangement) + numExtraSpeakers * sizeof(VstSpeakerProperties), 0);
+    auto speakerArrangement = reinterpret_cast<VstSpeakerArrangement*>(memory.data());
+
+    speakerArrangement->numChannels = numChannels;
 
     VstInt32 speakerTypes[] = {
       kSpeakerArrEmpty,
@@ -206,11 +170,21 @@ protected:
       kSpeakerArr80Music,
     };
 
-    speakerArrangement.type = speakerTypes[speakerArrangement.numChannels];
+    if (numChannels <= kFixedSpeakers) {
+      speakerArrangement->type = speakerTypes[numChannels];
+    }
+    else {
+      speakerArrangement->type = kSpeakerArrUserDefined;
+    }
 
-    for (int i = 0; i < speakerArrangement.numChannels; ++i) {
-      speakerArrangement.speakers[i].type = kSpeakerUndefined;
+    // Indexing past speakers[7] is the point; memory was sized for it
+    VstSpeakerProperties* speakers = speakerArrangement->speakers;
+    for (int i = 0; i < numChannels; ++i) {
+      speakers[i].type = kSpeakerUndefined;
+      snprintf(speakers[i].name, sizeof(speakers[i].name), "%d", i + 1);
     }
+
+    return speakerArrangement;
   }
 
 public:
@@ -224,18 +198,25 @@ public:
     this->type = VstPluginType::Instrument;
   }
 
+  inline const std::string& getName() const {
+    return name;
+  }
+
+  inline ulong getNumProcessCalls() const {
+    return numProcessCalls;
+  }
+
   int getSetting(Setting setting) {
     switch (setting) {
-      case Setting::TailTimeInMs: {
+      case Setting::TailFrames: {
         VstInt32 tailSize = static_cast<VstInt32>(plugin->
           dispatcher(plugin, effGetTailSize, 0, 0, nullptr, 0.0f));
-        // VST SDK indicates plugins will return 1 for no tail
+        // VST SDK indicates plugins will return 1 for no tail; otherwise
+        // it is already in samples
         if (tailSize < 2) {
           return 0;
         }
-        // Otherwise it is in samples
-        return static_cast<int>(static_cast<double>(tailSize) *
-          GlobalSettings::get().getSampleRate() / 1000.0f);
+        return static_cast<int>(tailSize);
       }
       case Setting::NumInputs:
         return plugin->numInputs;
@@ -248,37 +229,33 @@ public:
     return 0;
   }
 
+  // Loads the plugin binary and opens the instance its entry function returns
   virtual bool open() {
-    // Attempt to load the DLL
-    this->handle = LoadLibraryExA((LPCSTR)absolutePath.c_str(),
-      nullptr, LOAD_WITH_ALTERED_SEARCH_PATH);
-    if (this->handle == nullptr) {
-      std::cerr << "Unable to load specified VSTi: " << GetLastErrorString().c_str() << std::endl;
+    if (!library.open(absolutePath)) {
+      std::cerr << "Unable to load specified VSTi: " << library.getLastError() << std::endl;
       return false;
     }
 
     // Find and execute the entry func to get the AEffect pointer
-    std::string entryFuncNames[] = {
+    const std::string entryFuncNames[] = {
       "VSTPluginMain",
       "VSTPluginMain()",
       "main"
     };
-
-    Vst2xPluginEntryFunc entryFunc = nullptr;
-    for (const auto& entryFuncName : entryFuncNames) {
-      entryFunc = reinterpret_cast<Vst2xPluginEntryFunc>
-        (GetProcAddress(this->handle, entryFuncName.c_str()));
-      if (entryFunc != nullptr) {
-        break;
-      }
-    }
+    auto entryFunc = reinterpret_cast<Vst2xPluginEntryFunc>(library.findSymbol(entryFuncNames));
 
     if (entryFunc == nullptr) {
       std::cerr << "Unable to find entry func in specified VSTi" << std::endl;
       return false;
     }
 
-    this->plugin = entryFunc(pluginVst2xHostCallback);
+    return open(entryFunc(pluginVst2xHostCallback));
+  }
+
+  // Opens an instance that already exists in this process, such as a
+  // ReferenceInstrument, with no binary to load
+  bool open(AEffect* effect) {
+    this->plugin = effect;
 
     if (this->plugin == nullptr) {
       std::cerr << "Specified VSTi returned null plugin instance" << std::endl;
@@ -306,6 +283,16 @@ public:
       return false;
     }
 
+    // We render one buffer width for inputs and outputs, sized by the outputs
+    if (plugin->numOutputs < 1 || plugin->numOutputs > USHRT_MAX) {
+      std::cerr << "Plugin has an unsupported number of outputs (" << plugin->numOutputs << ")" << std::endl;
+      return false;
+    }
+    if (plugin->numInputs > plugin->numOutputs) {
+      std::cerr << "Plugins with more inputs than outputs are not currently supported" << std::endl;
+      return false;
+    }
+
     // Setup
     plugin->dispatcher(plugin, effOpen, 0, 0, nullptr, 0.0f);
     plugin->dispatcher(plugin, effSetSampleRate, 0, 0,
@@ -313,13 +300,14 @@ public:
     plugin->dispatcher(plugin, effSetBlockSize, 0,
       static_cast<VstIntPtr>(GlobalSettings::get().getBlockSize()), nullptr, 0.0f);
 
-    VstSpeakerArrangement inSpeakers;
-    setupSpeakers(inSpeakers, plugin->numInputs);
-    VstSpeakerArrangement outSpeakers;
-    setupSpeakers(outSpeakers, plugin->numOutputs);
+    VstSpeakerArrangement* inSpeakers = setupSpeakers(inputSpeakerMemory, plugin->numInputs);
+    VstSpeakerArrangement* outSpeakers = setupSpeakers(outputSpeakerMemory, plugin->numOutputs);
 
     plugin->dispatcher(plugin, effSetSpeakerArrangement, 0,
-      reinterpret_cast<VstIntPtr>(&inSpeakers), &outSpeakers, 0.0f);
+      reinterpret_cast<VstIntPtr>(inSpeakers), outSpeakers, 0.0f);
+
+    // Allocate event memory once so the render loop never has to
+    eventRing.allocate(GlobalSettings::get().getMaxEventsPerBlock());
 
     return true;
   }
@@ -338,132 +326,644 @@ public:
     plugin->dispatcher(plugin, effStopProcess, 0, 0, nullptr, 0.0f);
   }
 
-  void processMidiEvents(std::queue<MidiEvent>& midiEvents) {
-    // Gee, sure hope it's done with the old data ...
+  // Prepares message events for the plugin, timed relative to startFrame (see
+  // VstEventRing::prepare). This can run ahead of the process call the events
+  // are for.
+  bool prepareMidiEvents(Span<const MidiEvent> midiEvents, Span<VstMidiEvent> vstMidiEvents, ulong startFrame) {
+    size_t numDropped;
+    if (!eventRing.prepare(midiEvents, vstMidiEvents, startFrame, numDropped)) {
+      RealtimeLog::get().log("No free event memory; plugin still owns every arena");
+      return false;
+    }
+    if (numDropped > 0) {
+      RealtimeLog::get().log("Too many events in block; dropping %zu", numDropped);
+    }
+    return true;
+  }
+
+  // Sends the oldest prepared events to the plugin; they stay untouched until
+  // the next processAudio has returned
+  void processMidiEvents() {
+    VstEvents* vstEvents = eventRing.dispatch();
+    TraceScope traceScope("processMidiEvents", "numEvents", vstEvents != nullptr ? vstEvents->numEvents : 0);
+    if (vstEvents != nullptr) {
+      plugin->dispatcher(plugin, effProcessEvents, 0, 0, vstEvents, 0.0f);
+    }
+  }
 
-    // Ensure our buffer has enough space
-    vstEventsBuffer.resize(sizeof(VstEvents) +
-      (midiEvents.size() * (sizeof(VstEvent*) + sizeof(VstMidiEvent))));
-    uchar* memPtr = vstEventsBuffer.data();
+  template <ushort kChannels> void processAudio(SampleBuffer<float, kChannels>& inputSampleBuffer,
+    SampleBuffer<float, kChannels>& outputSampleBuffer, ulong numFrames) {
 
-    // Get the VstEvents controlling structure
-    VstEvents* vstEvents = reinterpret_cast<VstEvents*>(memPtr);
+    // NOTE: we're ony processing a single plugin which is an instrument. The input
+    // buffer was cleared before rendering and will never be altered. And we only
+    // need to worry about writing to our output buffer. So this function is quite
+    // simple at the moment.
+
+    // Process; numFrames can be less than the block size we gave the plugin
+    // when a block has been split at a meta event
+    assert(numFrames <= outputSampleBuffer.getBlockSize());
+    TraceScope traceScope("processAudio", "numFrames", numFrames);
+    plugin->processReplacing(plugin, inputSampleBuffer.getSamples(),
+      outputSampleBuffer.getSamples(), static_cast<VstInt32>(numFrames));
+    ++numProcessCalls;
 
-    // Advance buffer pointer past VstEvents struct and memory for VstEvent pointers
-    memPtr += sizeof(VstEvents) + (midiEvents.size() * sizeof(VstEvent*));
+    // The plugin has consumed whatever events it was sent for this call
+    eventRing.retire();
+  }
 
-    // Iterate through MIDI events, generate VST events, and set pointers
-    vstEvents->numEvents = 0;
-    while (!midiEvents.empty()) {
-      auto midiEvent = midiEvents.front();
-      midiEvents.pop();
+  // Same as above for plugins running in double precision
+  template <ushort kChannels> void processAudio(SampleBuffer<double, kChannels>& inputSampleBuffer,
+    SampleBuffer<double, kChannels>& outputSampleBuffer, ulong numFrames) {
+    assert(numFrames <= outputSampleBuffer.getBlockSize());
+    TraceScope traceScope("processAudioDouble", "numFrames", numFrames);
+    plugin->processDoubleReplacing(plugin, inputSampleBuffer.getSamples(),
+      outputSampleBuffer.getSamples(), static_cast<VstInt32>(numFrames));
+    ++numProcessCalls;
 
-      if (midiEvent.eventType == MidiEvent::EventType::Message) {
+    eventRing.retire();
+  }
 
-        VstMidiEvent* vstMidiEvent = reinterpret_cast<VstMidiEvent*>(memPtr);
-        memPtr += sizeof(VstMidiEvent);
+  inline bool canProcessDouble() const {
+    return (plugin->flags & effFlagsCanDoubleReplacing) && plugin->processDoubleReplacing != nullptr;
+  }
 
-        memset(vstMidiEvent, 0, sizeof(VstMidiEvent));
-        vstMidiEvent->type = kVstMidiType;
-        vstMidiEvent->byteSize = sizeof(vstMidiEvent);
-        vstMidiEvent->deltaFrames = static_cast<VstInt32>(midiEvent.timeDelta);
-        vstMidiEvent->midiData[0] = midiEvent.dataptr[0];
-        vstMidiEvent->midiData[1] = midiEvent.dataptr[1];
-        vstMidiEvent->midiData[2] = midiEvent.dataptr[2];
+  // Only allowed while the plugin is suspended
+  void setProcessPrecision(VstProcessPrecision precision) {
+    plugin->dispatcher(plugin, effSetProcessPrecision, 0, precision, nullptr, 0.0f);
+  }
 
-        // VST documentation says vstMidiEvent->midiData[3] is reserved, but
-        // there are valid messages with info in that byte ...
+  // Some plugins convert to double internally on the float path, others are
+  // slower in double; the only way to know is to time both. Leaves the plugin
+  // suspended with the faster precision selected.
+  VstProcessPrecision selectProcessPrecision() {
+    if (!canProcessDouble()) {
+      return kVstProcessPrecision32;
+    }
 
-        vstEvents->events[vstEvents->numEvents] = reinterpret_cast<VstEvent*>(vstMidiEvent);
-        ++vstEvents->numEvents;
+    // An untimed round first, so neither precision pays for cold caches and
+    // first touches; then take turns going first and keep each one's best
+    timeProcessPrecision<float>(kVstProcessPrecision32);
+    timeProcessPrecision<double>(kVstProcessPrecision64);
+    double singleSeconds = 0.0;
+    double doubleSeconds = 0.0;
+    for (uint run = 0; run < kPrecisionBenchmarkRuns; ++run) {
+      double seconds[2];
+      if (run % 2 == 0) {
+        seconds[0] = timeProcessPrecision<float>(kVstProcessPrecision32);
+        seconds[1] = timeProcessPrecision<double>(kVstProcessPrecision64);
       }
+      else {
+        seconds[1] = timeProcessPrecision<double>(kVstProcessPrecision64);
+        seconds[0] = timeProcessPrecision<float>(kVstProcessPrecision32);
+      }
+      singleSeconds = run == 0 ? seconds[0] : std::min(singleSeconds, seconds[0]);
+      doubleSeconds = run == 0 ? seconds[1] : std::min(doubleSeconds, seconds[1]);
     }
-
-    plugin->dispatcher(plugin, effProcessEvents, 0, 0, vstEvents, 0.0f);
+    std::cout << "Plugin " << name << " processes " << kPrecisionBenchmarkBlocks <<
+      " blocks in " << singleSeconds * 1000.0 << "ms (single precision), " <<
+      doubleSeconds * 1000.0 << "ms (double precision)" << std::endl;
+
+    // A few percent either way is noise; stay with single unless double
+    // clearly wins
+    VstProcessPrecision precision = doubleSeconds < singleSeconds * kDoublePrecisionMargin ?
+      kVstProcessPrecision64 : kVstProcessPrecision32;
+    setProcessPrecision(precision);
+    return precision;
   }
 
-  void processAudio(VstSampleBuffer& inputSampleBuffer, VstSampleBuffer& outputSampleBuffer) {
+protected:
+  // Seconds to render kPrecisionBenchmarkBlocks blocks of a held note
+  template <typename T> double timeProcessPrecision(VstProcessPrecision precision) {
+    ulong blockSize = GlobalSettings::get().getBlockSize();
+    SampleBuffer<T> inputSampleBuffer(static_cast<ushort>(std::max(plugin->numInputs, 1)), blockSize);
+    SampleBuffer<T> outputSampleBuffer(static_cast<ushort>(std::max(plugin->numOutputs, 1)), blockSize);
+
+    setProcessPrecision(precision);
+    resume();
+
+    // One message at a time, each followed by a block, so it fits however
+    // little event memory the render needed
+    auto sendMessage = [&](MidiEvent::MessageType type, uchar status, uchar data1, uchar data2) {
+      MidiEvent midiEvent;
+      midiEvent.eventType = MidiEvent::EventType::Message;
+      midiEvent.message.type = type;
+      VstMidiEvent vstMidiEvent = { };
+      vstMidiEvent.type = kVstMidiType;
+      vstMidiEvent.byteSize = sizeof(VstMidiEvent);
+      vstMidiEvent.midiData[0] = static_cast<char>(status);
+      vstMidiEvent.midiData[1] = static_cast<char>(data1);
+      vstMidiEvent.midiData[2] = static_cast<char>(data2);
+      prepareMidiEvents(Span<const MidiEvent>(&midiEvent, 1), Span<VstMidiEvent>(&vstMidiEvent, 1), 0);
+      processMidiEvents();
+      processAudio(inputSampleBuffer, outputSampleBuffer, blockSize);
+    };
 
-    // NOTE: we're ony processing a single plugin which is an instrument. The input
-    // buffer was cleared on construction and will never be altered. And we only
-    // need to worry about writing to our output buffer. So this function is quite
-    // simple at the moment.
+    // Give it something to play; an idle synth may skip its DSP altogether.
+    // The first block warms up.
+    sendMessage(MidiEvent::MessageType::VoiceNoteOn, 0x90, 60, 100);
 
-    // Process
-    plugin->processReplacing(plugin, inputSampleBuffer.getSamples(),
-      outputSampleBuffer.getSamples(), static_cast<VstInt32>(outputSampleBuffer.getBlockSize()));
+    auto start = std::chrono::steady_clock::now();
+    for (uint i = 0; i < kPrecisionBenchmarkBlocks; ++i) {
+      processAudio(inputSampleBuffer, outputSampleBuffer, blockSize);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Release the note, then all notes off and all sound off, so nothing
+    // carries over into the render even on plugins that latch voices or
+    // ignore one of the controllers
+    sendMessage(MidiEvent::MessageType::VoiceNoteOff, 0x80, 60, 0);
+    sendMessage(MidiEvent::MessageType::ModeAllNotesOff, 0xB0, 0x7B, 0);
+    sendMessage(MidiEvent::MessageType::ModeAllSoundOff, 0xB0, 0x78, 0);
+
+    suspend();
+    return elapsed.count();
   }
 
 };
 
 DEFINE_string(midi, "", "Full path to MIDI file");
 DEFINE_string(vsti, "", "Full path to VST instrument plugin");
+DEFINE_bool(reference_instrument, false, "Render with the built-in reference instrument instead of --vsti, to measure the host on its own");
+DEFINE_uint32(reference_outputs, 2, "Outputs of the reference instrument");
+DEFINE_uint32(reference_voices, 32, "Voices of the reference instrument; the oldest is stolen beyond this");
+DEFINE_uint32(reference_burn, 0, "Extra work per voice per sample in the reference instrument, in dependent multiply-adds");
+DEFINE_string(reference_fault, "none", "Real-time fault for the reference instrument to commit in its process call: none, allocate or sleep");
+DEFINE_uint32(reference_fault_every, 1, "Blocks between the reference instrument's faults");
+DEFINE_uint32(reference_sleep_us, 1000, "How long the reference instrument sleeps with --reference_fault=sleep");
 DEFINE_string(wav, "", "Full path to WAV output file");
+DEFINE_uint32(block_size, 0, "Maximum frames per call to the plugin (0 for the default)");
+DEFINE_double(silence_threshold_db, -96.0, "Output level (dBFS) below which a block is considered silent");
+DEFINE_bool(skip_silence, true, "Write silent blocks directly instead of calling the plugin while it has nothing to play");
+DEFINE_double(max_tail_seconds, 30.0, "Longest tail to render after the end of the MIDI track");
+DEFINE_uint32(channel_mask, 0, "WAVE_FORMAT_EXTENSIBLE speaker mask for the output, e.g. 0x2D63F for 7.1.4 (0 = usual layout for the plugin's output count)");
+DEFINE_uint32(stem_channels, 0, "Write every this many output channels to their own WAV file, named after --wav with a stem number added (0 for a single file)");
+DEFINE_string(sample_format, "16", "WAV sample format: 8, 16, 24 or 32-bit PCM, or float");
+DEFINE_bool(normalize, false, "Scale the output so its loudest sample peaks at --normalize_peak_dbfs");
+DEFINE_double(normalize_peak_dbfs, -1.0, "Peak level to normalize to");
+DEFINE_bool(analyze, false, "Measure peak, RMS, true peak and loudness while rendering, and write them next to the WAV file as JSON");
+DEFINE_bool(hash, false, "Hash the audio data as it's written (XXH64) and write the digest, plus one per --hash_segment_seconds, next to the WAV file as JSON");
+DEFINE_double(hash_segment_seconds, 10.0, "Length of each separately hashed segment with --hash");
+DEFINE_bool(peaks, false, "Write waveform overviews (min/max per channel at 256, 4096 and 65536 samples per bin) next to the WAV file, as .peaks");
+DEFINE_bool(profile, false, "Time each stage of the render and report latency percentiles, real-time factor and the slowest blocks, on stdout and next to the WAV file as JSON");
+DEFINE_bool(perf_counters, false, "With --profile, also count cycles, instructions, cache misses and branch misses per stage (Linux perf_event_open; skipped where not permitted)");
+DEFINE_string(trace, "", "Record a timeline of plugin calls, host callbacks, encoding, I/O and MIDI parsing on every thread, and write it to this file in Chrome trace format (for chrome://tracing or Perfetto)");
+DEFINE_uint64(trace_zones_per_thread, TraceRecorder::kDefaultZonesPerThread, "Most recent zones kept per thread with --trace");
+DEFINE_bool(host_callback_stats, false, "Time every call the plugin makes back into the host, and report calls per block, total and worst time by opcode, on stdout and next to the WAV file as JSON (calls are always counted)");
+DEFINE_double(log_repeat_seconds, 1.0, "Diagnostics logged during the render are shown at most once per this many seconds each; repeats in between are counted");
+DEFINE_string(realtime_check, "off", "Debug builds: treat heap allocation and freeing on the render thread after the first block as errors; count reports each distinct call stack at the end, abort stops at the first (off, count or abort)");
+DEFINE_bool(realtime_check_blocking, false, "With --realtime_check, also catch blocking calls (mutex locks, condition waits, write, nanosleep) on the render thread (Linux only)");
+DEFINE_string(precision, "auto", "Plugin processing precision: single, double, or auto to use whichever is faster");
 
 VstPlugin *instrumentPlugin = nullptr;
 
-bool getBlockFromSequence(std::queue<MidiEvent>& midiSequence, ulong startTimeStamp, ulong endTimeStamp, std::queue<MidiEvent>& midiBlock)
+// Returns the events in [startTimeStamp, endTimeStamp) and advances position
+// past them; the span points into the sequence, nothing is copied
+Span<const MidiEvent> getBlockFromSequence(const std::vector<MidiEvent>& midiSequence,
+  size_t& position, ulong startTimeStamp, ulong endTimeStamp)
 {
-  while (true) {
-    // Finished sequence
-    if (midiSequence.empty()) {
-      return false;
-    }
+  // Discard any old events
+  while (position < midiSequence.size() && midiSequence[position].timeStamp < startTimeStamp) {
+    RealtimeLog::get().log("Expired time stamp while parsing MIDI events");
+    ++position;
+  }
 
-    auto nextEvent = midiSequence.front();
+  // End is exclusive so that every event's delta is within the block
+  size_t first = position;
+  while (position < midiSequence.size() && midiSequence[position].timeStamp < endTimeStamp) {
+    ++position;
+  }
+  return Span<const MidiEvent>(midiSequence.data() + first, position - first);
+}
 
-    // Discard any old events
-    if (nextEvent.timeStamp < startTimeStamp) {
-      std::cerr << "Expired time stamp while parsing MIDI events" << std::endl;
-      midiSequence.pop();
-      continue;
+// Applies a single meta event; returns false at the end of the track
+bool processMetaEvent(const MidiEvent& midiEvent) {
+  assert(midiEvent.eventType == MidiEvent::EventType::Meta);
+  switch (midiEvent.meta.type) {
+    case MidiEvent::MetaType::SetTempo: {
+      double tempo;
+      unsigned long beatLengthInUs = static_cast<unsigned long>
+        ((midiEvent.dataptr[0] << 16) | (midiEvent.dataptr[1] << 8) | (midiEvent.dataptr[2]));
+      tempo = (1000000.0 / static_cast<double>(beatLengthInUs)) * 60.0;
+      GlobalSettings::get().setTempo(tempo);
+      AudioClock::get().updateTimeInfo();
+      break;
     }
-
-    // Exit on first out-of-range event
-    if (endTimeStamp < nextEvent.timeStamp) {
+    case MidiEvent::MetaType::TimeSignature: {
+      GlobalSettings::get().setBeatsPerMeasure(midiEvent.dataptr[0]);
+      GlobalSettings::get().setNoteValue(static_cast<unsigned short>(powl(2, midiEvent.dataptr[1])));
+      AudioClock::get().updateTimeInfo();
       break;
     }
-
-    midiSequence.pop();
-
-    nextEvent.timeDelta = nextEvent.timeStamp - startTimeStamp;
-    midiBlock.push(nextEvent);
+    case MidiEvent::MetaType::EndOfTrack:
+      return false;
   }
   return true;
 }
 
-bool processMetaEvents(std::queue<MidiEvent>& midiEvents) {
-  bool finished = false;
-  while (!midiEvents.empty()) {
-    auto midiEvent = midiEvents.front();
-    midiEvents.pop();
-    if (midiEvent.eventType == MidiEvent::EventType::Meta) {
-      switch (midiEvent.meta.type) {
-        case MidiEvent::MetaType::SetTempo: {
-          double tempo;
-          unsigned long beatLengthInUs = static_cast<unsigned long>
-            ((midiEvent.dataptr[0] << 16) | (midiEvent.dataptr[1] << 8) | (midiEvent.dataptr[2]));
-          tempo = (1000000.0 / static_cast<double>(beatLengthInUs)) * 60.0;
-          GlobalSettings::get().setTempo(tempo);
-          break;
+// Plays the track through the plugin into output (a PcmWavFile or a
+// StemWriter), processing in T (float or double) precision with kChannels
+// channels (see ChannelCount.h). analyzer, if any, sees everything written.
+template <typename T, ushort kChannels, typename Output>
+void renderTrack(VstPlugin& plugin, MidiTrack& track, Output& output, AudioAnalyzer* analyzer) {
+  // Played in place; we just keep track of how far we've got
+  const auto& midiSequence = track.sequence;
+  auto& vstSequence = track.vstSequence;
+  size_t sequencePosition = 0;
+
+  // Create sample buffers
+  // VST plugins take an input sample buffer and an output sample buffer; this
+  // is because the VST plugin could be an effect (which would require input
+  // audio to which the effect would be applied) or an instrument (which just
+  // requires output). The graph is just instrument (node 0) -> WAV file
+  // (node 1) for now.
+  AudioBufferArena<T, kChannels> bufferArena(
+    GlobalSettings::get().getNumChannels(),
+    GlobalSettings::get().getBlockSize());
+  auto inputEdge = bufferArena.addEdge(0, 0);
+  auto outputEdge = bufferArena.addEdge(0, 1);
+  bufferArena.allocate();
+
+  // Nothing writes the instrument's input, and buffers come from the
+  // arena as-is
+  SampleBuffer<T, kChannels>& inputSampleBuffer = bufferArena.getBuffer(inputEdge);
+  SampleBuffer<T, kChannels>& outputSampleBuffer = bufferArena.getBuffer(outputEdge);
+  inputSampleBuffer.zero();
+
+  // Once every note has ended and the output has stayed quiet for the
+  // plugin's tail, the plugin has nothing more to contribute until it
+  // gets new events. Always wait at least one block so plugins which
+  // report no tail still get a chance to ring out.
+  ulong tailFrames = std::max(static_cast<ulong>(plugin.
+    getSetting(VstPlugin::Setting::TailFrames)), GlobalSettings::get().getBlockSize());
+  ulong maxTailFrames = std::max(tailFrames, static_cast<ulong>
+    (FLAGS_max_tail_seconds * GlobalSettings::get().getSampleRate()));
+  SilenceDetector silenceDetector(static_cast<float>(FLAGS_silence_threshold_db), tailFrames);
+  NoteTracker noteTracker;
+
+  // Sample rate and block size are settled by now
+  AudioClock::get().updateTimeInfo();
+
+  // Start 'er up
+  plugin.resume();
+
+  // This only works as a non-real-time process, because we are just
+  // repeatedly grabbing 'blocksize' events from the sequence and pushing
+  // them to the VSTi. We need to find a way to time sync.
+  bool sequenceFinished = false;
+  bool renderFinished = false;
+  ulong sequenceEndFrame = 0;
+  ulong numBlocks = 0;
+  ulong renderAllocations = 0;
+  RenderProfiler& profiler = RenderProfiler::get();
+  profiler.registerThread();
+  while (!renderFinished) {
+    // The first block is allowed to warm up lazily-allocated plugin state
+    RealtimeScope realtimeScope(numBlocks > 0);
+    TraceScope traceScope("renderBlock", "frame", AudioClock::get().getCurrentFrame());
+    ulong allocationsAtBlockStart = AllocationCounter::getCount();
+    uint64_t blockStartTime = profiler.isEnabled() ? RenderProfiler::now() : 0;
+
+    ulong blockStartFrame = AudioClock::get().getCurrentFrame();
+    ulong blockEndFrame = blockStartFrame + GlobalSettings::get().getBlockSize();
+
+    // Get next block
+    Span<const MidiEvent> midiBlock;
+    {
+      ProfileScope profileScope(RenderStage::MidiBlock);
+      midiBlock = getBlockFromSequence(midiSequence,
+        sequencePosition, blockStartFrame, blockEndFrame);
+    }
+    if (!sequenceFinished && sequencePosition == midiSequence.size() && midiBlock.empty()) {
+      // Ran out of events without seeing the end of the track
+      sequenceFinished = true;
+      sequenceEndFrame = blockStartFrame;
+    }
+
+    // Meta events change state the plugin sees for every frame after
+    // them (e.g. tempo via audioMasterGetTime), so the block is split
+    // into sub-blocks which each start at a meta event. Block size
+    // then only limits the cost per call, not timing accuracy.
+    size_t blockPosition = 0;
+    ulong subBlockStartFrame = blockStartFrame;
+    while (subBlockStartFrame < blockEndFrame) {
+      // Meta events due now are applied before any audio is processed
+      while (blockPosition < midiBlock.size() &&
+        midiBlock[blockPosition].eventType == MidiEvent::EventType::Meta &&
+        midiBlock[blockPosition].timeStamp <= subBlockStartFrame) {
+        ProfileScope profileScope(RenderStage::MetaEvents);
+        if (!processMetaEvent(midiBlock[blockPosition]) && !sequenceFinished) {
+          sequenceFinished = true;
+          sequenceEndFrame = subBlockStartFrame;
+        }
+        ++blockPosition;
+      }
+
+      // Followed by the run of messages up to the next meta event
+      size_t firstMessage = blockPosition;
+      while (blockPosition < midiBlock.size() &&
+        midiBlock[blockPosition].eventType == MidiEvent::EventType::Message) {
+        noteTracker.process(midiBlock[blockPosition]);
+        ++blockPosition;
+      }
+      auto subBlock = midiBlock.subspan(firstMessage, blockPosition - firstMessage);
+      Span<VstMidiEvent> vstSubBlock(vstSequence.data() +
+        (subBlock.data() - midiSequence.data()), subBlock.size());
+
+      ulong subBlockEndFrame = blockEndFrame;
+      if (blockPosition < midiBlock.size()) {
+        if (midiBlock[blockPosition].timeStamp > subBlockStartFrame) {
+          subBlockEndFrame = midiBlock[blockPosition].timeStamp;
+        }
+        // Only the end of the track sorts after messages with the same
+        // time stamp, and nothing follows it
+        else {
+          ProfileScope profileScope(RenderStage::MetaEvents);
+          if (!processMetaEvent(midiBlock[blockPosition]) && !sequenceFinished) {
+            sequenceFinished = true;
+            sequenceEndFrame = subBlockStartFrame;
+          }
+          ++blockPosition;
         }
-        case MidiEvent::MetaType::TimeSignature: {
-          GlobalSettings::get().setBeatsPerMeasure(midiEvent.dataptr[0]);
-          GlobalSettings::get().setNoteValue(static_cast<unsigned short>(powl(2, midiEvent.dataptr[1])));
+      }
+      ulong subBlockFrames = subBlockEndFrame - subBlockStartFrame;
+
+      bool pluginIdle = subBlock.empty() && !noteTracker.
+        hasActiveNotes() && silenceDetector.isSilent();
+
+      // Stop at the true end of the audio rather than at the end of the track
+      if (sequenceFinished) {
+        if (pluginIdle) {
+          renderFinished = true;
           break;
         }
-        case MidiEvent::MetaType::EndOfTrack:
-          finished = true;
+        if (subBlockStartFrame - sequenceEndFrame >= maxTailFrames) {
+          RealtimeLog::get().log("Plugin tail did not decay below silence threshold; truncating");
+          renderFinished = true;
           break;
+        }
+      }
+
+      if (pluginIdle && FLAGS_skip_silence) {
+        // Nothing to play and nothing ringing out, so don't bother the plugin
+        {
+          ProfileScope profileScope(RenderStage::WriteOutput);
+          output.writeSilence(subBlockFrames);
+        }
+        if (analyzer != nullptr) {
+          ProfileScope profileScope(RenderStage::Analysis);
+          analyzer->processSilence(subBlockFrames);
+        }
+      }
+      else {
+        // Send messages to plugin
+        {
+          ProfileScope profileScope(RenderStage::MidiEvents);
+          plugin.prepareMidiEvents(subBlock, vstSubBlock, subBlockStartFrame);
+          plugin.processMidiEvents();
+        }
+
+        // Process audio
+        {
+          ProfileScope profileScope(RenderStage::ProcessAudio);
+          plugin.processAudio(inputSampleBuffer, outputSampleBuffer, subBlockFrames);
+        }
+        {
+          ProfileScope profileScope(RenderStage::Analysis);
+          silenceDetector.process(outputSampleBuffer, subBlockFrames);
+          if (analyzer != nullptr) {
+            analyzer->process(outputSampleBuffer, subBlockFrames);
+          }
+        }
+
+        // Write out to WAV file
+        {
+          ProfileScope profileScope(RenderStage::WriteOutput);
+          output.writeBuffer(outputSampleBuffer, subBlockFrames);
+        }
       }
+
+      AudioClock::get().advance(subBlockFrames);
+      subBlockStartFrame = subBlockEndFrame;
+    }
+
+    if (blockStartTime != 0) {
+      profiler.recordBlock(blockStartFrame, AudioClock::get().getCurrentFrame() - blockStartFrame,
+        RenderProfiler::now() - blockStartTime);
+    }
+
+    if (numBlocks++ > 0) {
+      renderAllocations += AllocationCounter::getCount() - allocationsAtBlockStart;
+    }
+  }
+
+  if (AllocationCounter::isEnabled()) {
+    std::cout << "Heap allocations in render loop after first block: " <<
+      renderAllocations << " over " << numBlocks << " blocks" << std::endl;
+  }
+  if (RealtimeChecker::get().isEnabled()) {
+    RealtimeChecker::get().printReport(std::cout);
+  }
+}
+
+// --sample_format to what we write
+bool parseSampleFormat(const std::string& sampleFormat, AudioBitDepth& bitDepth) {
+  if (sampleFormat == "8") {
+    bitDepth = AudioBitDepth::Type8;
+  }
+  else if (sampleFormat == "16") {
+    bitDepth = AudioBitDepth::Type16;
+  }
+  else if (sampleFormat == "24") {
+    bitDepth = AudioBitDepth::Type24;
+  }
+  else if (sampleFormat == "32") {
+    bitDepth = AudioBitDepth::Type32;
+  }
+  else if (sampleFormat == "float") {
+    bitDepth = AudioBitDepth::TypeFloat32;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+// Renders into one WAV file, or one per stem if --stem_channels asks for them
+template <typename T, ushort kChannels> void renderToOutput(VstPlugin& plugin, MidiTrack& track, AudioBitDepth bitDepth) {
+  // Analysis and the profile cover the whole bus, stems or not; their
+  // sidecars name the files that were written
+  std::vector<std::string> audioFileNames { FLAGS_wav };
+  std::unique_ptr<AudioAnalyzer> analyzer;
+  if (FLAGS_analyze) {
+    analyzer = std::make_unique<AudioAnalyzer>(GlobalSettings::get().getNumChannels(),
+      GlobalSettings::get().getSampleRate(), GlobalSettings::get().getBlockSize(),
+      FLAGS_channel_mask != PcmWavFile::kDefaultChannelMask ? FLAGS_channel_mask :
+      PcmWavFile::getDefaultChannelMask(GlobalSettings::get().getNumChannels()));
+  }
+
+  if (FLAGS_stem_channels == 0) {
+    PcmWavFile pcmWavFile;
+    if (FLAGS_normalize) {
+      pcmWavFile.setNormalization(FLAGS_normalize_peak_dbfs);
+    }
+    if (FLAGS_hash) {
+      pcmWavFile.setContentHash(FLAGS_hash_segment_seconds);
+    }
+    if (FLAGS_peaks) {
+      pcmWavFile.setWaveformPeaks();
+    }
+
+    if (!pcmWavFile.openWrite(FLAGS_wav,
+      static_cast<uint>(GlobalSettings::get().getNumChannels()),
+      static_cast<uint>(GlobalSettings::get().getSampleRate()),
+      bitDepth, FLAGS_channel_mask)) {
+      std::cerr << "Unable to create WAV file" << std::endl;
+      return;
+    }
+
+    renderTrack<T, kChannels>(plugin, track, pcmWavFile, analyzer.get());
+    pcmWavFile.closeWrite();
+
+    if (analyzer != nullptr) {
+      analyzer->setOutputGain(pcmWavFile.getNormalizationGain());
+    }
+  }
+  else {
+    // Normalizing stems separately would change the balance between them
+    if (FLAGS_normalize) {
+      std::cerr << "Normalization is not supported with stems; writing them as rendered" << std::endl;
+    }
+
+    StemWriter<T> stemWriter;
+    if (FLAGS_hash) {
+      stemWriter.setContentHash(FLAGS_hash_segment_seconds);
+    }
+    if (FLAGS_peaks) {
+      stemWriter.setWaveformPeaks();
+    }
+
+    if (!stemWriter.openWrite(FLAGS_wav,
+      GlobalSettings::get().getNumChannels(),
+      static_cast<ushort>(std::min(FLAGS_stem_channels, static_cast<uint32_t>(USHRT_MAX))),
+      static_cast<uint>(GlobalSettings::get().getSampleRate()),
+      bitDepth)) {
+      std::cerr << "Unable to create stem WAV files" << std::endl;
+      return;
+    }
+    audioFileNames = stemWriter.getStemFileNames(FLAGS_wav);
+
+    renderTrack<T, kChannels>(plugin, track, stemWriter, analyzer.get());
+    stemWriter.closeWrite();
+  }
+
+  // Every thread that recorded has finished by now
+  if (RenderProfiler::get().isEnabled()) {
+    RenderProfiler::get().setPluginName(plugin.getName());
+    RenderProfiler::get().printSummary(std::cout, GlobalSettings::get().getSampleRate());
+
+    std::filesystem::path profilePath(FLAGS_wav);
+    profilePath.replace_extension(".profile.json");
+    if (RenderProfiler::get().writeJson(profilePath.string(), audioFileNames, GlobalSettings::get().getSampleRate())) {
+      std::cout << "Profile written to " << profilePath.string() << std::endl;
+    }
+  }
+
+  if (FLAGS_host_callback_stats) {
+    HostCallbackStats& hostCallbackStats = HostCallbackStats::get();
+    hostCallbackStats.printReport(std::cout, plugin.getName(), plugin.getNumProcessCalls());
+
+    std::filesystem::path hostCallsPath(FLAGS_wav);
+    hostCallsPath.replace_extension(".hostcalls.json");
+    if (hostCallbackStats.writeJson(hostCallsPath.string(), plugin.getName(), plugin.getNumProcessCalls())) {
+      std::cout << "Host callback report written to " << hostCallsPath.string() << std::endl;
+    }
+  }
+
+  if (analyzer != nullptr) {
+    std::filesystem::path analysisPath(FLAGS_wav);
+    analysisPath.replace_extension(".json");
+    if (analyzer->writeJson(analysisPath.string(), audioFileNames)) {
+      std::cout << "Integrated loudness " << analyzer->getIntegratedLoudness() <<
+        " LUFS; analysis written to " << analysisPath.string() << std::endl;
     }
   }
-  return !finished;
 }
 
 int main(int argc, char *argv[])
 {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RenderProfiler::get().setEnabled(FLAGS_profile);
+  RenderProfiler::get().setCountersEnabled(FLAGS_profile && FLAGS_perf_counters);
+  if (FLAGS_perf_counters && !FLAGS_profile) {
+    std::cerr << "--perf_counters only applies with --profile" << std::endl;
+  }
+  HostCallbackStats::get().setTiming(FLAGS_host_callback_stats);
+  RealtimeLog::get().setRepeatInterval(FLAGS_log_repeat_seconds);
+  RealtimeLog::get().start();
+  if (!FLAGS_trace.empty()) {
+    TraceRecorder::get().enable(static_cast<size_t>(FLAGS_trace_zones_per_thread));
+  }
+
+  if (FLAGS_realtime_check != "off") {
+    RealtimeChecker::Mode realtimeMode;
+    if (FLAGS_realtime_check == "count") {
+      realtimeMode = RealtimeChecker::Mode::Count;
+    }
+    else if (FLAGS_realtime_check == "abort") {
+      realtimeMode = RealtimeChecker::Mode::Abort;
+    }
+    else {
+      std::cerr << "Unknown real-time check " << FLAGS_realtime_check << "; expected off, count or abort" << std::endl;
+      return 1;
+    }
+
+    if (!RealtimeChecker::isAvailable()) {
+      std::cerr << "--realtime_check needs a debug build; ignoring it" << std::endl;
+    }
+    else {
+      if (FLAGS_realtime_check_blocking && !RealtimeChecker::canCheckBlocking()) {
+        std::cerr << "Blocking calls can't be checked on this platform; only checking allocations" << std::endl;
+      }
+      RealtimeChecker::get().setMode(realtimeMode, FLAGS_realtime_check_blocking);
+    }
+  }
+  else if (FLAGS_realtime_check_blocking) {
+    std::cerr << "--realtime_check_blocking only applies with --realtime_check" << std::endl;
+  }
+
+  AudioBitDepth bitDepth;
+  if (!parseSampleFormat(FLAGS_sample_format, bitDepth)) {
+    std::cerr << "Unknown sample format " << FLAGS_sample_format << "; expected 8, 16, 24, 32 or float" << std::endl;
+    return 1;
+  }
+
+  if (FLAGS_precision != "single" && FLAGS_precision != "double" && FLAGS_precision != "auto") {
+    std::cerr << "Unknown precision " << FLAGS_precision << "; expected single, double or auto" << std::endl;
+    return 1;
+  }
+
+  if (FLAGS_hash && FLAGS_hash_segment_seconds <= 0.0) {
+    std::cerr << "Hash segments need to be longer than 0 seconds" << std::endl;
+    return 1;
+  }
+
+  ReferenceInstrument::Settings referenceSettings;
+  referenceSettings.numOutputs = static_cast<int>(FLAGS_reference_outputs);
+  referenceSettings.maxVoices = FLAGS_reference_voices;
+  referenceSettings.burnPerVoice = FLAGS_reference_burn;
+  referenceSettings.faultEveryBlocks = FLAGS_reference_fault_every;
+  referenceSettings.sleepMicroseconds = FLAGS_reference_sleep_us;
+  if (!ReferenceInstrument::parseFault(FLAGS_reference_fault, referenceSettings.fault)) {
+    std::cerr << "Unknown reference instrument fault " << FLAGS_reference_fault << "; expected none, allocate or sleep" << std::endl;
+    return 1;
+  }
+  if (FLAGS_reference_instrument && !FLAGS_vsti.empty()) {
+    std::cerr << "--reference_instrument replaces --vsti; ignoring " << FLAGS_vsti << std::endl;
+  }
+
+  if (FLAGS_block_size != 0) {
+    GlobalSettings::get().setBlockSize(FLAGS_block_size);
+  }
 
   if (FLAGS_midi.length() != 0) {
     MidiSource midiFile;
@@ -477,80 +977,65 @@ int main(int argc, char *argv[])
         std::cerr << "Currently unable to support MIDI other than type 0" << std::endl;
       }
       else {
-        if (FLAGS_vsti.length() != 0) {
-          instrumentPlugin = new VstPlugin(FLAGS_vsti);
-          if (instrumentPlugin->open()) {
-            // Create the output file
-            PcmWavFile pcmWavFile;
-
-            if (!pcmWavFile.openWrite(FLAGS_wav,
-              static_cast<uint>(GlobalSettings::get().getNumChannels()),
-              static_cast<uint>(GlobalSettings::get().getSampleRate()),
-              AudioBitDepth::Type16)) {
-              std::cerr << "Unable to create WAV file" << std::endl;
+        if (FLAGS_vsti.length() != 0 || FLAGS_reference_instrument) {
+          // Size event storage for the densest block we will send
+          GlobalSettings::get().setMaxEventsPerBlock(std::max(static_cast<ulong>(1),
+            static_cast<ulong>(midiFile.getMaxMessagesInWindow(0, GlobalSettings::get().getBlockSize()))));
+
+          bool opened;
+          if (FLAGS_reference_instrument) {
+            instrumentPlugin = new VstPlugin(ReferenceInstrument::kName);
+            opened = instrumentPlugin->open(ReferenceInstrument::create(referenceSettings, pluginVst2xHostCallback));
+          }
+          else {
+            instrumentPlugin = new VstPlugin(FLAGS_vsti);
+            opened = instrumentPlugin->open();
+          }
+
+          if (opened) {
+            // One WAV channel per plugin output, however many there are
+            GlobalSettings::get().setNumChannels(static_cast<ushort>
+              (instrumentPlugin->getSetting(VstPlugin::Setting::NumOutputs)));
+
+            bool useDoublePrecision = false;
+            if (FLAGS_precision == "double" && !instrumentPlugin->canProcessDouble()) {
+              std::cerr << "Plugin does not support double precision; using single" << std::endl;
             }
-            else {
-              // Make a copy of the sequence queue
-              std::queue<MidiEvent> midiSequence = midiFile.getTracks()[0].sequence;
-
-              // Create sample buffers
-              // VST plugins take an input sample buffer and an output sample buffer; this
-              // is because the VST plugin could be an effect (which would require input
-              // audio to which the effect would be applied) or an instrument (which just
-              // requires output).
-              VstSampleBuffer inputSampleBuffer(
-                GlobalSettings::get().getNumChannels(),
-                GlobalSettings::get().getBlockSize());
-              VstSampleBuffer outputSampleBuffer(
-                GlobalSettings::get().getNumChannels(),
-                GlobalSettings::get().getBlockSize());
-
-              // Start 'er up
-              instrumentPlugin->resume();
-
-              // This only works as a non-real-time process, because we are just
-              // repeatedly grabbing 'blocksize' events from the queue and pushing
-              // them to the VSTi. We need to find a way to time sync.
-              bool finishedSimulating = false;
-              while (!finishedSimulating) {
-                // Get next block
-                std::queue<MidiEvent> midiBlock;
-                finishedSimulating = !getBlockFromSequence(midiSequence,
-                  AudioClock::get().getCurrentFrame(),
-                  AudioClock::get().getCurrentFrame() + GlobalSettings::get().getBlockSize(),
-                  midiBlock);
-
-                // This seems suspect ... processing a full block of events then
-                // processing the notes would seem to make things like tempo
-                // changes happen at the wrong time. This seems to assume such
-                // things will only happen at t=0
-
-                // Process events
-                auto metaQueue = midiBlock;
-                if (!processMetaEvents(metaQueue)) {
-                  finishedSimulating = true;
-                }
-
-                // Send messages to plugin
-                instrumentPlugin->processMidiEvents(midiBlock);
-
-                // Process audio
-                instrumentPlugin->processAudio(inputSampleBuffer, outputSampleBuffer);
-
-                // Write out to WAV file
-                pcmWavFile.writeBuffer(outputSampleBuffer);
-
-                // Fixed clock advance rate
-                AudioClock::get().advance(GlobalSettings::get().getBlockSize());
-              }
+            else if (FLAGS_precision == "double") {
+              useDoublePrecision = true;
+              instrumentPlugin->setProcessPrecision(kVstProcessPrecision64);
+            }
+            else if (FLAGS_precision == "auto") {
+              useDoublePrecision = instrumentPlugin->
+                selectProcessPrecision() == kVstProcessPrecision64;
+            }
+
+            if (useDoublePrecision) {
+              std::cout << "Rendering in double precision" << std::endl;
             }
-            pcmWavFile.closeWrite();
+
+            // Pick the render loop compiled for our channel count
+            dispatchChannelCount(GlobalSettings::get().getNumChannels(), [&](auto channelCount) {
+              constexpr ushort kChannels = decltype(channelCount)::value;
+              if (useDoublePrecision) {
+                renderToOutput<double, kChannels>(*instrumentPlugin, midiFile.getTracks()[0], bitDepth);
+              }
+              else {
+                renderToOutput<float, kChannels>(*instrumentPlugin, midiFile.getTracks()[0], bitDepth);
+              }
+            });
           }
         }
       }
     }
   }
 
+  // Every other thread has finished by now
+  RealtimeLog::get().stop();
+  if (TraceRecorder::get().isEnabled() && TraceRecorder::get().writeJson(FLAGS_trace)) {
+    std::cout << "Trace written to " << FLAGS_trace << std::endl;
+  }
+
   return 0;
 }
 
@@ -0,0 +1,122 @@
+#include "MappedFile.h"
+#include <iostream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& fileName, bool writable) {
+  close();
+
+  HANDLE fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+    FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    std::cerr << "Unable to open " << fileName << " for mapping" << std::endl;
+    return false;
+  }
+  file = fileHandle;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(fileHandle, &fileSize)) {
+    std::cerr << "Unable to get size of " << fileName << std::endl;
+    close();
+    return false;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+
+  // Empty files can't be mapped, but there's nothing to see anyway
+  if (size == 0) {
+    return true;
+  }
+
+  mapping = CreateFileMappingA(fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    std::cerr << "Unable to map " << fileName << std::endl;
+    close();
+    return false;
+  }
+
+  data = static_cast<uchar*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+  if (data == nullptr) {
+    std::cerr << "Unable to map a view of " << fileName << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedFile::close() {
+  bool succeeded = true;
+  if (data != nullptr) {
+    succeeded = FlushViewOfFile(data, 0) != 0;
+    UnmapViewOfFile(data);
+    data = nullptr;
+  }
+  if (mapping != nullptr) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+  }
+  if (file != nullptr) {
+    CloseHandle(file);
+    file = nullptr;
+  }
+  size = 0;
+  return succeeded;
+}
+#else
+bool MappedFile::open(const std::string& fileName, bool writable) {
+  close();
+
+  file = ::open(fileName.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (file < 0) {
+    std::cerr << "Unable to open " << fileName << " for mapping" << std::endl;
+    return false;
+  }
+
+  struct stat fileStat;
+  if (fstat(file, &fileStat) != 0) {
+    std::cerr << "Unable to get size of " << fileName << std::endl;
+    close();
+    return false;
+  }
+  size = static_cast<size_t>(fileStat.st_size);
+
+  // Empty files can't be mapped, but there's nothing to see anyway
+  if (size == 0) {
+    return true;
+  }
+
+  void* mapped = mmap(nullptr, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, file, 0);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "Unable to map " << fileName << std::endl;
+    close();
+    return false;
+  }
+  data = static_cast<uchar*>(mapped);
+
+  // We only ever stream through
+  madvise(data, size, MADV_SEQUENTIAL);
+  return true;
+}
+
+bool MappedFile::close() {
+  bool succeeded = true;
+  if (data != nullptr) {
+    succeeded = msync(data, size, MS_SYNC) == 0;
+    munmap(data, size);
+    data = nullptr;
+  }
+  if (file >= 0) {
+    ::close(file);
+    file = -1;
+  }
+  size = 0;
+  return succeeded;
+}
+#endif
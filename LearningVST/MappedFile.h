@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include "Types.h"
+
+// A whole file mapped into memory, for reworking a file we've written in
+// place instead of reading it back through a stream
+class MappedFile {
+protected:
+  uchar* data = nullptr;
+  size_t size = 0;
+
+#ifdef _WIN32
+  void* file = nullptr;    // HANDLE
+  void* mapping = nullptr; // HANDLE
+#else
+  int file = -1;
+#endif
+
+public:
+  MappedFile() {
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    close();
+  }
+
+  bool open(const std::string& fileName, bool writable);
+
+  // Unmaps, flushing any changes to disk first
+  bool close();
+
+  inline uchar* getData() {
+    return data;
+  }
+
+  inline size_t getSize() const {
+    return size;
+  }
+};
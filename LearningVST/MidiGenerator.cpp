@@ -0,0 +1,245 @@
+#include "MidiGenerator.h"
+#include <math.h>
+#include <algorithm>
+
+MidiGenerator::MidiGenerator(const MidiGeneratorProfile& profile, uint64_t seed) {
+  this->profile = profile;
+  this->state = seed;
+}
+
+const std::vector<MidiGeneratorProfile>& MidiGenerator::getProfiles() {
+  static const std::vector<MidiGeneratorProfile> profiles = [] {
+    std::vector<MidiGeneratorProfile> profiles;
+    MidiGeneratorProfile profile;
+
+    profile = MidiGeneratorProfile();
+    profile.name = "sparse";
+    profile.description = "One track, a couple of notes a second";
+    profile.seconds = 120.0;
+    profile.notesPerSecond = 2.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "dense";
+    profile.description = "16 busy tracks with controller movement";
+    profile.numTracks = 16;
+    profile.tempo = 140.0;
+    profile.notesPerSecond = 20.0;
+    profile.controllersPerSecond = 20.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "bursts";
+    profile.description = "Runs of 32nd notes on top of a steady part";
+    profile.numTracks = 4;
+    profile.tempo = 160.0;
+    profile.burstsPerMinute = 30.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "cc_flood";
+    profile.description = "A thousand controller changes a second per track";
+    profile.numTracks = 2;
+    profile.controllersPerSecond = 1000.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "tempo_map";
+    profile.description = "Ten tempo changes a second";
+    profile.seconds = 120.0;
+    profile.tempoChangesPerMinute = 600.0;
+    profile.notesPerSecond = 8.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "many_tracks";
+    profile.description = "1000 tracks, each doing very little";
+    profile.numTracks = 1000;
+    profile.seconds = 30.0;
+    profile.notesPerSecond = 1.0;
+    profile.controllersPerSecond = 1.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "long";
+    profile.description = "Three hours of four tracks";
+    profile.numTracks = 4;
+    profile.seconds = 3.0 * 60.0 * 60.0;
+    profile.tempoChangesPerMinute = 1.0;
+    profiles.push_back(profile);
+
+    profile = MidiGeneratorProfile();
+    profile.name = "edge_cases";
+    profile.description = "Zero-length metas and notes, range extremes, events piled on one tick";
+    profile.numTracks = 3;
+    profile.seconds = 30.0;
+    profile.tempoChangesPerMinute = 30.0;
+    profile.emptyMetasPerMinute = 120.0;
+    profile.edgeCases = true;
+    profiles.push_back(profile);
+
+    return profiles;
+  }();
+  return profiles;
+}
+
+const MidiGeneratorProfile* MidiGenerator::findProfile(const std::string& name) {
+  for (const auto& profile : getProfiles()) {
+    if (profile.name == name) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+uint64_t MidiGenerator::next() {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+uint MidiGenerator::nextInRange(uint low, uint high) {
+  return low + static_cast<uint>(next() % (static_cast<uint64_t>(high) - low + 1));
+}
+
+double MidiGenerator::nextUnit() {
+  return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+ulong MidiGenerator::getCount(double perSecond) const {
+  return static_cast<ulong>(llround(std::max(perSecond, 0.0) * profile.seconds));
+}
+
+void MidiGenerator::addTempoMap(SmfWriter& smfWriter, size_t track, ulong numTicks) {
+  smfWriter.addTempo(track, 0, profile.tempo);
+  smfWriter.addTimeSignature(track, 0, 4, 4);
+
+  // Wander within a quarter of the base tempo either way
+  ulong numChanges = getCount(profile.tempoChangesPerMinute / 60.0);
+  for (ulong i = 0; i < numChanges; ++i) {
+    ulong tick = static_cast<ulong>(nextUnit() * numTicks);
+    smfWriter.addTempo(track, tick, profile.tempo * (0.75 + 0.5 * nextUnit()));
+  }
+}
+
+void MidiGenerator::addNotes(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks) {
+  const ulong kSixteenth = kTimeDivision / 4;
+  const ulong kThirtySecond = kTimeDivision / 8;
+  ulong numSixteenths = std::max(numTicks / kSixteenth, 1ul);
+
+  smfWriter.addMessage(track, 0, MidiEvent::MessageType::VoiceProgramChange, channel,
+    static_cast<uchar>(nextInRange(0, 127)));
+
+  ulong numNotes = getCount(profile.notesPerSecond);
+  for (ulong i = 0; i < numNotes; ++i) {
+    ulong tick = nextInRange(0, static_cast<uint>(numSixteenths - 1)) * kSixteenth;
+    ulong duration = nextInRange(1, 16) * kSixteenth;
+    smfWriter.addNote(track, tick, duration, channel, static_cast<uchar>(nextInRange(24, 108)),
+      static_cast<uchar>(nextInRange(30, 127)));
+  }
+
+  ulong numBursts = getCount(profile.burstsPerMinute / 60.0);
+  for (ulong i = 0; i < numBursts; ++i) {
+    ulong tick = nextInRange(0, static_cast<uint>(numSixteenths - 1)) * kSixteenth;
+    uchar key = static_cast<uchar>(nextInRange(48, 84));
+    for (uint note = 0; note < profile.notesPerBurst; ++note) {
+      smfWriter.addNote(track, tick + note * kThirtySecond, kThirtySecond, channel,
+        static_cast<uchar>(key + (note % 12)), static_cast<uchar>(nextInRange(60, 127)));
+    }
+  }
+}
+
+void MidiGenerator::addControllers(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks) {
+  // Modulation, volume, pan, expression, sustain and brightness, plus pitch bend
+  static const uchar controllers[] = { 1, 7, 10, 11, 64, 74 };
+
+  ulong numControllers = getCount(profile.controllersPerSecond);
+  for (ulong i = 0; i < numControllers; ++i) {
+    ulong tick = static_cast<ulong>(nextUnit() * numTicks);
+    uint choice = nextInRange(0, sizeof(controllers));
+    if (choice == sizeof(controllers)) {
+      uint bend = nextInRange(0, 0x3FFF);
+      smfWriter.addMessage(track, tick, MidiEvent::MessageType::VoicePitchBend, channel,
+        static_cast<uchar>(bend & 0x7F), static_cast<uchar>(bend >> 7));
+    }
+    else {
+      smfWriter.addMessage(track, tick, MidiEvent::MessageType::VoiceControllerChange, channel,
+        controllers[choice], static_cast<uchar>(nextInRange(0, 127)));
+    }
+  }
+}
+
+void MidiGenerator::addEmptyMetas(SmfWriter& smfWriter, size_t track, ulong numTicks) {
+  static const MidiEvent::MetaType types[] = {
+    MidiEvent::MetaType::TextEvent,
+    MidiEvent::MetaType::Marker,
+    MidiEvent::MetaType::CuePoint,
+    MidiEvent::MetaType::Lyric,
+    MidiEvent::MetaType::SequencerSpecificMetaEvent,
+  };
+
+  ulong numMetas = getCount(profile.emptyMetasPerMinute / 60.0);
+  for (ulong i = 0; i < numMetas; ++i) {
+    ulong tick = static_cast<ulong>(nextUnit() * numTicks);
+    smfWriter.addMeta(track, tick, types[nextInRange(0, sizeof(types) / sizeof(types[0]) - 1)]);
+  }
+}
+
+void MidiGenerator::addEdgeCases(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks) {
+  // Extremes of key and velocity, right at the start
+  smfWriter.addNote(track, 0, kTimeDivision, channel, 0, 1);
+  smfWriter.addNote(track, 0, kTimeDivision, channel, 127, 127);
+
+  // Zero-length notes: on and off on the same tick
+  for (ulong i = 0; i < 16; ++i) {
+    smfWriter.addNote(track, static_cast<ulong>(nextUnit() * numTicks), 0, channel,
+      static_cast<uchar>(nextInRange(0, 127)), static_cast<uchar>(nextInRange(1, 127)));
+  }
+
+  // A pile-up: every key at once on one tick, with controllers, pressure and
+  // a mode message alongside
+  ulong pileUpTick = numTicks / 2;
+  for (uint key = 0; key < 128; ++key) {
+    smfWriter.addNote(track, pileUpTick, kTimeDivision, channel, static_cast<uchar>(key), 100);
+    smfWriter.addMessage(track, pileUpTick, MidiEvent::MessageType::VoicePolyphonicKeyPressure, channel,
+      static_cast<uchar>(key), static_cast<uchar>(key));
+  }
+  smfWriter.addMessage(track, pileUpTick, MidiEvent::MessageType::VoiceKeyPressure, channel, 127);
+  smfWriter.addMessage(track, pileUpTick, MidiEvent::MessageType::VoicePitchBend, channel, 0, 0);
+  smfWriter.addMessage(track, pileUpTick, MidiEvent::MessageType::VoicePitchBend, channel, 0x7F, 0x7F);
+  smfWriter.addMessage(track, pileUpTick + kTimeDivision, MidiEvent::MessageType::ModeAllNotesOff, channel, 0);
+
+  // Notes that end at the very end of the track, and one that starts there
+  smfWriter.addNote(track, numTicks - kTimeDivision, kTimeDivision, channel, 60, 64);
+  smfWriter.addNote(track, numTicks, 0, channel, 61, 64);
+}
+
+SmfWriter MidiGenerator::generate(ushort format) {
+  SmfWriter smfWriter(kTimeDivision);
+  ulong numTicks = std::max(static_cast<ulong>(llround(profile.seconds * profile.tempo / 60.0 * kTimeDivision)),
+    static_cast<ulong>(kTimeDivision));
+  uint numTracks = std::max(profile.numTracks, 1u);
+
+  size_t tempoTrack = smfWriter.addTrack();
+  smfWriter.addText(tempoTrack, 0, MidiEvent::MetaType::SequenceOrTrackName, profile.name);
+  addTempoMap(smfWriter, tempoTrack, numTicks);
+
+  for (uint i = 0; i < numTracks; ++i) {
+    size_t track = tempoTrack;
+    if (format != 0) {
+      track = smfWriter.addTrack();
+      smfWriter.addText(track, 0, MidiEvent::MetaType::SequenceOrTrackName, "Track " + std::to_string(i + 1));
+    }
+    uchar channel = static_cast<uchar>(i % 16);
+
+    addNotes(smfWriter, track, channel, numTicks);
+    addControllers(smfWriter, track, channel, numTicks);
+    addEmptyMetas(smfWriter, track, numTicks);
+    if (profile.edgeCases) {
+      addEdgeCases(smfWriter, track, channel, numTicks);
+    }
+  }
+
+  return smfWriter;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "Types.h"
+#include "SmfWriter.h"
+
+// What a generated MIDI file looks like. Rates are per track and average out
+// over the file; durations assume the base tempo, so tempo changes stretch or
+// shrink them a little.
+struct MidiGeneratorProfile {
+  std::string name;
+  std::string description;
+  uint numTracks = 1;              // Tracks with notes; format 1 adds a tempo track
+  double seconds = 60.0;
+  double tempo = 120.0;            // Beats per minute
+  double tempoChangesPerMinute = 0.0;
+  double notesPerSecond = 4.0;
+  double burstsPerMinute = 0.0;    // Runs of back-to-back 32nd notes
+  uint notesPerBurst = 32;
+  double controllersPerSecond = 0.0;
+  double emptyMetasPerMinute = 0.0; // Zero-length text, marker and cue point events
+  bool edgeCases = false;          // Zero-length notes, extremes of every range, pile-ups on one tick
+};
+
+// Writes reproducible MIDI files for stress tests and benchmarks: the same
+// profile and seed give the same file on every platform (the random numbers
+// don't come from <random>, whose distributions vary between libraries).
+class MidiGenerator {
+public:
+  static constexpr ushort kTimeDivision = 480;
+
+protected:
+  MidiGeneratorProfile profile;
+  uint64_t state;
+
+  // splitmix64
+  uint64_t next();
+  uint nextInRange(uint low, uint high); // Inclusive
+  double nextUnit(); // [0, 1)
+
+  // Rate per track scaled to the file's length
+  ulong getCount(double perSecond) const;
+
+  void addNotes(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks);
+  void addControllers(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks);
+  void addEmptyMetas(SmfWriter& smfWriter, size_t track, ulong numTicks);
+  void addEdgeCases(SmfWriter& smfWriter, size_t track, uchar channel, ulong numTicks);
+  void addTempoMap(SmfWriter& smfWriter, size_t track, ulong numTicks);
+
+public:
+  MidiGenerator(const MidiGeneratorProfile& profile, uint64_t seed);
+
+  // The built-in profiles: sparse, dense, bursts, cc_flood, tempo_map,
+  // many_tracks, long and edge_cases
+  static const std::vector<MidiGeneratorProfile>& getProfiles();
+  static const MidiGeneratorProfile* findProfile(const std::string& name);
+
+  // Format 0 puts everything on one track, each of the profile's tracks on its
+  // own channel (wrapping after 16); format 1 gives each its own track, after a
+  // tempo track
+  SmfWriter generate(ushort format);
+};
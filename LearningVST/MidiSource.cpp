@@ -5,8 +5,11 @@
 #include <vector>
 #include <streambuf>
 #include <assert.h>
+#include <string.h>
 #include <map>
+#include <algorithm>
 #include "AudioClock.h"
+#include "TraceRecorder.h"
 
 std::map<unsigned char, MidiEvent::EventType> ByteSignatureToReservedEventType = {
   { 0xFF, MidiEvent::EventType::Meta },
@@ -32,7 +35,18 @@ std::map<unsigned char, MidiEvent::MetaType> ByteSignatureToMidiMetaType = {
   { 0x7F, MidiEvent::MetaType::SequencerSpecificMetaEvent },
 };
 
+// Order of events sharing a time stamp in the playback sequence: tempo and time
+// signature changes take effect before any notes at that time, and the end of
+// the track comes after them
+static int sequenceRank(const MidiEvent& midiEvent) {
+  if (midiEvent.eventType == MidiEvent::EventType::Meta) {
+    return midiEvent.meta.type == MidiEvent::MetaType::EndOfTrack ? 2 : 0;
+  }
+  return 1;
+}
+
 bool MidiSource::openFile(const std::string& fileName) {
+  TraceScope traceScope("openMidiFile");
   std::ifstream ifs(fileName, std::ios::binary);
   if (!ifs) {
     std::cerr << "Unable to open MIDI file " << fileName << std::endl;
@@ -134,9 +148,15 @@ bool MidiSource::parseHeader(endian_bytestream& ebs) {
 
 
 bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
+  TraceScope traceScope("readTrack", "trackIndex", trackIndex);
   assert(trackIndex < tracks.size());
 
-  ulong currentTimeInSampleFrames = 0;
+  // Kept fractional so rounding doesn't accumulate over long tracks
+  double currentTimeInSampleFrames = 0.0;
+
+  // Timestamps follow tempo changes in the track, so events after a SetTempo
+  // land on the frame at which they will actually be played
+  double tempo = GlobalSettings::get().getTempo();
 
   MidiTrack& currentTrack = tracks[trackIndex];
 
@@ -176,9 +196,9 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
 
     // Generate absolute timestamp from relative delta
     assert(timeDivisionType == TimeDivisionType::TicksPerQuarterNote);
-    double ticksPerSecond = static_cast<double>(timeDivision) * GlobalSettings::get().getTempo() / 60.0;
+    double ticksPerSecond = static_cast<double>(timeDivision) * tempo / 60.0;
     double sampleFramesPerTick = GlobalSettings::get().getSampleRate() / ticksPerSecond;
-    currentTimeInSampleFrames += static_cast<long>(deltaTime * sampleFramesPerTick);
+    currentTimeInSampleFrames += deltaTime * sampleFramesPerTick;
 
     // Next is the event type
     ebs >> readByte;
@@ -191,7 +211,7 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
     if (eventType != ByteSignatureToReservedEventType.end()) {
       MidiEvent currentEvent;
 
-      currentEvent.timeStamp = currentTimeInSampleFrames;
+      currentEvent.timeStamp = static_cast<ulong>(currentTimeInSampleFrames);
       currentEvent.eventType = eventType->second;
 
       switch (eventType->second) {
@@ -225,6 +245,16 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
               if (!ebs.isGood("while reading meta data")) {
                 return false;
               }
+
+              // Subsequent delta times are in the new tempo
+              if (currentEvent.meta.type == MidiEvent::MetaType::SetTempo && currentEvent.datalen == 3) {
+                const uchar* tempoData = currentTrack.eventData.data() + eventDataIndex.back();
+                unsigned long beatLengthInUs = static_cast<unsigned long>
+                  ((tempoData[0] << 16) | (tempoData[1] << 8) | (tempoData[2]));
+                if (beatLengthInUs > 0) {
+                  tempo = (1000000.0 / static_cast<double>(beatLengthInUs)) * 60.0;
+                }
+              }
             }
             else {
               // Push empty marker into data index vector for bookkeeping
@@ -261,7 +291,7 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
     else {
       MidiEvent currentEvent;
 
-      currentEvent.timeStamp = currentTimeInSampleFrames;
+      currentEvent.timeStamp = static_cast<ulong>(currentTimeInSampleFrames);
       currentEvent.eventType = MidiEvent::EventType::Message;
 
       // All messages have a byte of status plus at least one byte of data
@@ -371,6 +401,8 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
 
   assert(eventDataIndex.size() == currentTrack.events.size());
 
+  std::vector<MidiEvent> sequence;
+
   auto eventIter = currentTrack.events.begin();
   for (const auto& dataIndex : eventDataIndex) {
     // Fixup data pointers
@@ -385,13 +417,13 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
           case MidiEvent::MetaType::SetTempo:
           case MidiEvent::MetaType::TimeSignature:
           case MidiEvent::MetaType::EndOfTrack:
-            currentTrack.sequence.push(*eventIter);
+            sequence.push_back(*eventIter);
             break;
         }
         break;
       }
       case MidiEvent::EventType::Message: {
-        currentTrack.sequence.push(*eventIter);
+        sequence.push_back(*eventIter);
         break;
       }
       default:
@@ -400,6 +432,66 @@ bool MidiSource::readTrack(endian_bytestream& ebs, unsigned int trackIndex) {
 
     ++eventIter;
   }
+
+  std::stable_sort(sequence.begin(), sequence.end(),
+    [](const MidiEvent& a, const MidiEvent& b) {
+      if (a.timeStamp != b.timeStamp) {
+        return a.timeStamp < b.timeStamp;
+      }
+      return sequenceRank(a) < sequenceRank(b);
+    });
+
+  // Nothing plays after the end of the track
+  auto endOfTrack = std::find_if(sequence.begin(), sequence.end(),
+    [](const MidiEvent& midiEvent) {
+      return midiEvent.eventType == MidiEvent::EventType::Meta &&
+        midiEvent.meta.type == MidiEvent::MetaType::EndOfTrack;
+    });
+  if (endOfTrack != sequence.end()) {
+    sequence.erase(endOfTrack + 1, sequence.end());
+  }
+
+  currentTrack.sequence = std::move(sequence);
+
+  // Translate messages up front so the host only has to set deltaFrames when
+  // it sends them. Meta events keep a zeroed slot so indices line up.
+  currentTrack.vstSequence.resize(currentTrack.sequence.size());
+  for (size_t i = 0; i < currentTrack.sequence.size(); ++i) {
+    const auto& midiEvent = currentTrack.sequence[i];
+    if (midiEvent.eventType == MidiEvent::EventType::Message) {
+      auto& vstMidiEvent = currentTrack.vstSequence[i];
+      vstMidiEvent.type = kVstMidiType;
+      vstMidiEvent.byteSize = sizeof(VstMidiEvent);
+
+      // VST documentation says midiData[3] is reserved, but there are valid
+      // messages with info in that byte ...
+      memcpy(vstMidiEvent.midiData, midiEvent.dataptr, std::min(midiEvent.datalen, static_cast<ushort>(3)));
+    }
+  }
   return true;
 }
 
+size_t MidiSource::getMaxMessagesInWindow(unsigned int trackIndex, ulong numFrames) const {
+  assert(trackIndex < tracks.size());
+
+  // Sliding window over the time-ordered sequence
+  const auto& sequence = tracks[trackIndex].sequence;
+  size_t maxMessages = 0;
+  size_t windowMessages = 0;
+  size_t windowStart = 0;
+  for (size_t windowEnd = 0; windowEnd < sequence.size(); ++windowEnd) {
+    if (sequence[windowEnd].eventType != MidiEvent::EventType::Message) {
+      continue;
+    }
+    ++windowMessages;
+    while (sequence[windowStart].timeStamp + numFrames <= sequence[windowEnd].timeStamp) {
+      if (sequence[windowStart].eventType == MidiEvent::EventType::Message) {
+        --windowMessages;
+      }
+      ++windowStart;
+    }
+    maxMessages = std::max(maxMessages, windowMessages);
+  }
+  return maxMessages;
+}
+
@@ -3,8 +3,8 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <queue>
 #include "Types.h"
+#include "VstSdk.h"
 #include <sstream>
 #include <iostream>
 
@@ -64,7 +64,6 @@ struct MidiEvent {
   }; 
 
   ulong timeStamp = 0;
-  ulong timeDelta = 0;
 
   uchar* dataptr = nullptr;
   ushort datalen = 0;
@@ -73,7 +72,8 @@ struct MidiEvent {
 struct MidiTrack {
   std::vector<MidiEvent> events;
   std::vector<uchar> eventData;
-  std::queue<MidiEvent> sequence;
+  std::vector<MidiEvent> sequence; // Playback order; ends at the first EndOfTrack
+  std::vector<VstMidiEvent> vstSequence; // Ready-to-send copy of each message in sequence (same index)
   unsigned int index;
 };
 
@@ -133,7 +133,10 @@ protected:
 public:
   bool openFile(const std::string& fileName);
 
-  inline const std::vector<MidiTrack> getTracks() {
+  inline const std::vector<MidiTrack>& getTracks() const {
+    return tracks;
+  }
+  inline std::vector<MidiTrack>& getTracks() {
     return tracks;
   }
   inline size_t getTrackCount() const {
@@ -142,4 +145,8 @@ public:
   inline unsigned short getFormatType() const {
     return formatType;
   }
+
+  // Most message events the track plays in any window of numFrames; sizes
+  // per-block event storage up front
+  size_t getMaxMessagesInWindow(unsigned int trackIndex, ulong numFrames) const;
 };
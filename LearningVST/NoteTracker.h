@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include "Types.h"
+#include "MidiSource.h"
+
+// Counts sounding notes per channel and key so the renderer knows when the
+// instrument has been told to be quiet
+class NoteTracker {
+protected:
+  static constexpr uint kNumChannels = 16;
+  static constexpr uint kNumKeys = 128;
+
+  std::array<uchar, kNumChannels * kNumKeys> noteCounts = { };
+  uint activeNotes = 0;
+
+  void noteOff(uint channel, uint key) {
+    auto& count = noteCounts[channel * kNumKeys + key];
+    if (count > 0) {
+      --count;
+      --activeNotes;
+    }
+  }
+
+  void allNotesOff(uint channel) {
+    for (uint key = 0; key < kNumKeys; ++key) {
+      activeNotes -= noteCounts[channel * kNumKeys + key];
+      noteCounts[channel * kNumKeys + key] = 0;
+    }
+  }
+
+public:
+  void process(const MidiEvent& midiEvent) {
+    if (midiEvent.eventType != MidiEvent::EventType::Message) {
+      return;
+    }
+
+    uint channel = midiEvent.dataptr[0] & 0x0F;
+    switch (midiEvent.message.type) {
+      case MidiEvent::MessageType::VoiceNoteOn: {
+        uint key = midiEvent.dataptr[1] & 0x7F;
+        // Note on with zero velocity is a note off
+        if (midiEvent.dataptr[2] == 0) {
+          noteOff(channel, key);
+        }
+        else if (noteCounts[channel * kNumKeys + key] < 0xFF) {
+          ++noteCounts[channel * kNumKeys + key];
+          ++activeNotes;
+        }
+        break;
+      }
+      case MidiEvent::MessageType::VoiceNoteOff:
+        noteOff(channel, midiEvent.dataptr[1] & 0x7F);
+        break;
+      case MidiEvent::MessageType::ModeAllNotesOff:
+      case MidiEvent::MessageType::ModeAllSoundOff:
+        allNotesOff(channel);
+        break;
+      default:
+        break;
+    }
+  }
+
+  inline bool hasActiveNotes() const {
+    return activeNotes > 0;
+  }
+};
@@ -1,9 +1,53 @@
 #include "PcmWavFile.h"
 #include <iostream>
 #include <fstream>
+#include <assert.h>
+#include <stddef.h>
+#include <filesystem>
 #include "SampleBuffer.h"
+#include "GlobalSettings.h"
+#include "MappedFile.h"
 
-bool PcmWavFile::openWrite(const std::string& fileName, uint numChannels, uint sampleRate, AudioBitDepth bitDepth) {
+uint PcmWavFile::getDefaultChannelMask(uint numChannels) {
+  static const uint channelMasks[] = {
+    0x0,   // None
+    0x4,   // Mono: FC
+    0x3,   // Stereo: FL FR
+    0x7,   // 3.0: FL FR FC
+    0x33,  // Quad: FL FR BL BR
+    0x37,  // 5.0: FL FR FC BL BR
+    0x3F,  // 5.1: FL FR FC LFE BL BR
+    0x13F, // 6.1: FL FR FC LFE BL BR BC
+    0x63F, // 7.1: FL FR FC LFE BL BR SL SR
+  };
+
+  if (numChannels < sizeof(channelMasks) / sizeof(channelMasks[0])) {
+    return channelMasks[numChannels];
+  }
+  return 0;
+}
+
+void PcmWavFile::setNormalization(double targetDbfs) {
+  normalize = true;
+  normalizeTargetPeak = pow(10.0, targetDbfs / 20.0);
+}
+
+void PcmWavFile::setContentHash(double segmentSeconds) {
+  hashSegmentSeconds = segmentSeconds;
+}
+
+void PcmWavFile::setWaveformPeaks() {
+  writePeaks = true;
+}
+
+std::string PcmWavFile::getContentHashFileName(const std::string& fileName) {
+  std::filesystem::path path(fileName);
+  path.replace_extension(".hash.json");
+  return path.string();
+}
+
+bool PcmWavFile::openWrite(const std::string& fileName, uint numChannels, uint sampleRate, AudioBitDepth bitDepth,
+  uint channelMask) {
   this->bitDepth = bitDepth;
   this->fileName = fileName;
 
@@ -11,114 +55,227 @@ bool PcmWavFile::openWrite(const std::string& fileName, uint numChannels, uint s
   // will fixup later
   header.format.numChannels = numChannels;
   header.format.sampleRate = sampleRate;
-  header.format.bitsPerSample = static_cast<ushort>(bitDepth);
+  header.format.bitsPerSample = getBitsPerSample(bitDepth);
 
   header.format.byteRate = header.format.sampleRate *
     (header.format.numChannels * header.format.bitsPerSample / 8);
   header.format.blockAlign = static_cast<ushort>
     (header.format.numChannels * header.format.bitsPerSample / 8);
 
-  ss.write(reinterpret_cast<char *>(&header), sizeof(header));
+  bool isFloat = bitDepth == AudioBitDepth::TypeFloat32;
+  if (isFloat) {
+    header.format.format = kFormatFloat;
+    header.extension.subFormat[0] = static_cast<uchar>(kFormatFloat); // KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+  }
 
-  return true;
-}
+  bool isExtensible = numChannels > 2 || (!isFloat && header.format.bitsPerSample > 16);
+  if (isExtensible) {
+    // A mask can't position more channels than there are
+    uint numMaskedChannels = 0;
+    for (uint bits = channelMask; bits != 0; bits &= bits - 1) {
+      ++numMaskedChannels;
+    }
+    if (channelMask == kDefaultChannelMask || numMaskedChannels > numChannels) {
+      if (channelMask != kDefaultChannelMask) {
+        std::cerr << "Channel mask 0x" << std::hex << channelMask << std::dec <<
+          " has more speakers than the " << numChannels << " channels; using the default" << std::endl;
+      }
+      channelMask = getDefaultChannelMask(numChannels);
+    }
 
-bool PcmWavFile::closeWrite() {
-  // Seek to header.data.chunkSize and write the actual amount of data
-  int offset1 = reinterpret_cast<int>(&header.data.chunkSize) - reinterpret_cast<int>(&header);
-  ss.seekp(offset1, std::ios::beg);
-  ss.write(reinterpret_cast<char*>(&dataBytesWritten), sizeof(dataBytesWritten));
+    header.format.format = kFormatExtensible;
+    header.format.chunkSize = sizeof(PcmHeader::PcmFormat) - 8 + sizeof(PcmHeader::Extension);
+    header.extension.validBitsPerSample = header.format.bitsPerSample;
+    header.extension.channelMask = channelMask;
+  }
 
-  int offset2 = reinterpret_cast<int>(&header.riff.chunkSize) - reinterpret_cast<int>(&header);
-  ss.seekp(offset2, std::ios::beg);
-  uint chunkSize = dataBytesWritten + sizeof(header) - 8;
-  ss.write(reinterpret_cast<char *>(&chunkSize), sizeof(chunkSize));
+  ofs.open(this->fileName, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create WAV file " << fileName << std::endl;
+    return false;
+  }
 
-  std::ofstream ofs(this->fileName, std::ios::binary | std::ios::trunc);
+  // Plain PCM headers go straight from the format chunk to the data chunk
+  ofs.write(reinterpret_cast<char *>(&header.riff), sizeof(header.riff));
+  ofs.write(reinterpret_cast<char *>(&header.format), sizeof(header.format));
+  if (isExtensible) {
+    ofs.write(reinterpret_cast<char *>(&header.extension), sizeof(header.extension));
+  }
+  ofs.write(reinterpret_cast<char *>(&header.data), sizeof(header.data));
+  headerBytesWritten = static_cast<uint>(ofs.tellp());
 
-  // Of course it is really rough to have this error kill the process at the
-  // last step ... but it's also rough to hold onto a write handle the entire
-  // time, or to write directly to a file rather than a buffer.
-  if (!ofs) {
-    std::cerr << "Unable to create WAV file" << std::endl;
+  if (hashSegmentSeconds > 0.0) {
+    contentHash = std::make_unique<ContentHash>(
+      static_cast<ulong>(hashSegmentSeconds * sampleRate + 0.5), header.format.blockAlign);
   }
 
-  ofs.write(ss.str().c_str(), ss.str().length());
-  ofs.flush();
-  ofs.close();
+  if (writePeaks) {
+    waveformPeaks = std::make_unique<WaveformPeaks>();
+    if (!waveformPeaks->openWrite(this->fileName, static_cast<ushort>(numChannels), sampleRate)) {
+      ofs.close();
+      return false;
+    }
+  }
+
+  // Staged samples go to a raw float file alongside
+  if (isStaging()) {
+    stagingFileName = this->fileName + ".staging";
+    stagingOfs.open(stagingFileName, std::ios::binary | std::ios::trunc);
+    if (!stagingOfs) {
+      std::cerr << "Unable to create staging file " << stagingFileName << std::endl;
+      ofs.close();
+      return false;
+    }
+  }
+
+  // Room for a full block so conversion never has to grow the buffer
+  pcmBuffer.reserve(GlobalSettings::get().getBlockSize() *
+    std::max(static_cast<size_t>(header.format.blockAlign), numChannels * sizeof(float)));
 
   return true;
 }
 
-bool PcmWavFile::writeBuffer(const VstSampleBuffer& sampleBuffer) {
-  auto numSamplesToWrite = sampleBuffer.getNumChannels() * sampleBuffer.getBlockSize();
+bool PcmWavFile::closeWrite() {
+  if (!ofs.is_open()) {
+    return false;
+  }
 
-  // Data from the VST SDK is channel sequential (channel 1 bufsize samples, channel 2 bufsize samples, ..., channel N bufsize samples)
-  // PCM is encoded as channel-interleaved (channel 1,2,...,N sample 0, channel 1,2,...,N sample 1, ..., channel 1,2,...,N sample bufsize)
-  // Here we convert and interleave the data
+  TraceScope traceScope("closeWrite");
+  bool succeeded = true;
+  if (normalize && peak > 0.0) {
+    normalizationGain = normalizeTargetPeak / peak;
+    std::cout << "Normalizing " << fileName << " by " << 20.0 * log10(normalizationGain) << "dB" << std::endl;
+  }
+  if (isStaging()) {
+    succeeded = quantizeStaging();
+  }
 
-  auto byteDepth = static_cast<int>(this->bitDepth) / 8;
+  // Seek to header.data.chunkSize (the header's last member) and write the
+  // actual amount of data
+  ofs.seekp(headerBytesWritten - sizeof(header.data.chunkSize), std::ios::beg);
+  ofs.write(reinterpret_cast<char*>(&dataBytesWritten), sizeof(dataBytesWritten));
 
-  // Ensure we have room to store the data
-  pcmBuffer.resize(numSamplesToWrite * byteDepth);
+  ofs.seekp(offsetof(PcmHeader, riff.chunkSize), std::ios::beg);
+  uint chunkSize = dataBytesWritten + headerBytesWritten - 8;
+  ofs.write(reinterpret_cast<char *>(&chunkSize), sizeof(chunkSize));
 
-  // Maximum value of a PCM sample
-  auto pcmSampleMaxValue = pow(2.0,
-    static_cast<double>(header.format.bitsPerSample - 1)) - 1.0;
+  ofs.flush();
+  succeeded = ofs.good() && succeeded;
+  ofs.close();
 
-  // Incoming values from VST are [-1.0,1.0]
-  switch (this->bitDepth) {
-    // 8-bit PCM samples are [0,255] - the only unsigned bit depth
-    case AudioBitDepth::Type8: {
-      uchar* outBuf = pcmBuffer.data();
-      for (ulong s = 0; s < sampleBuffer.getBlockSize(); ++s) {
-        for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
-          *outBuf++ = static_cast<uchar>((sampleBuffer.
-            getSamples()[c][s] + 1.0f) * pcmSampleMaxValue);
-        }
-      }
-      break;
-    }
-    // All other bit depths are standard two's complement signed
-    case AudioBitDepth::Type16: {
-      short* outBuf = reinterpret_cast<short*>(pcmBuffer.data());
-      for (ulong s = 0; s < sampleBuffer.getBlockSize(); ++s) {
-        for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
-          *outBuf++ = static_cast<short>(sampleBuffer.
-            getSamples()[c][s] * pcmSampleMaxValue);
-        }
-      }
-      break;
+  if (succeeded && isRescalingInPlace() && (normalizationGain != 1.0 || contentHash != nullptr)) {
+    succeeded = rescaleInPlace();
+  }
+
+  if (waveformPeaks != nullptr) {
+    waveformPeaks->setOutputGain(normalizationGain);
+    if (waveformPeaks->closeWrite()) {
+      std::cout << "Waveform peaks written to " << WaveformPeaks::getFileName(fileName) << std::endl;
     }
-    case AudioBitDepth::Type24: {
-      uchar* outBuf = pcmBuffer.data();
-      for (ulong s = 0; s < sampleBuffer.getBlockSize(); ++s) {
-        for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
-          int sampleAsInt = static_cast<int>
-            (sampleBuffer.getSamples()[c][s] * pcmSampleMaxValue);
-
-          *outBuf++ = static_cast<uchar>((sampleAsInt) & 0xFF);
-          *outBuf++ = static_cast<uchar>((sampleAsInt >> 8) & 0xFF);
-          *outBuf++ = static_cast<uchar>((sampleAsInt >> 16) & 0xFF);
-        }
-      }
-      break;
+    else {
+      succeeded = false;
     }
-    case AudioBitDepth::Type32: {
-      int* outBuf = reinterpret_cast<int*>(pcmBuffer.data());
-      for (ulong s = 0; s < sampleBuffer.getBlockSize(); ++s) {
-        for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
-          *outBuf++ = static_cast<int>
-            (sampleBuffer.getSamples()[c][s] * pcmSampleMaxValue);
-        }
-      }
-      break;
+  }
+
+  if (succeeded && contentHash != nullptr) {
+    auto hashFileName = getContentHashFileName(fileName);
+    if (contentHash->writeJson(hashFileName, fileName, header.format.sampleRate)) {
+      std::cout << "Content hash of " << fileName << ": xxh64 " <<
+        Xxh64::toString(contentHash->getDigest()) << "; digests written to " << hashFileName << std::endl;
     }
   }
 
-  ss.write(reinterpret_cast<char*>(pcmBuffer.data()), numSamplesToWrite * byteDepth);
+  if (!succeeded) {
+    std::cerr << "Error while writing WAV file " << fileName << std::endl;
+  }
+  return succeeded;
+}
+
+bool PcmWavFile::writeSilence(ulong numFrames) {
+  ProfileScope profileScope(RenderStage::FileWrite);
+  TraceScope traceScope("writeSilence", "numFrames", numFrames);
+  auto numBytesToWrite = numFrames * header.format.blockAlign;
+
+  if (waveformPeaks != nullptr) {
+    waveformPeaks->processSilence(numFrames);
+  }
+
+  if (isStaging()) {
+    auto numStagingBytes = numFrames * header.format.numChannels * sizeof(float);
+    pcmBuffer.resize(numStagingBytes);
+    memset(pcmBuffer.data(), 0, numStagingBytes);
+    stagingOfs.write(reinterpret_cast<char*>(pcmBuffer.data()), numStagingBytes);
+
+    this->dataBytesWritten += numBytesToWrite;
+    return true;
+  }
+
+  // 8-bit PCM is unsigned; writeBuffer maps 0.0 to the middle of the range
+  uchar silenceValue = 0;
+  if (this->bitDepth == AudioBitDepth::Type8) {
+    silenceValue = static_cast<uchar>(pow(2.0, 7.0) - 1.0);
+  }
+
+  pcmBuffer.resize(numBytesToWrite);
+  memset(pcmBuffer.data(), silenceValue, numBytesToWrite);
 
-  this->dataBytesWritten += numSamplesToWrite * byteDepth;
+  writeData(pcmBuffer.data(), numBytesToWrite);
+
+  this->dataBytesWritten += numBytesToWrite;
 
   return true;
-}
\ No newline at end of file
+}
+
+// Scales the staged float samples by the normalization gain and writes them
+// out in our real format, streaming through the mapping a block at a time
+bool PcmWavFile::quantizeStaging() {
+  stagingOfs.close();
+  if (!stagingOfs) {
+    std::cerr << "Error while writing staging file " << stagingFileName << std::endl;
+    return false;
+  }
+
+  MappedFile staging;
+  if (!staging.open(stagingFileName, true)) {
+    return false;
+  }
+
+  float* samples = reinterpret_cast<float*>(staging.getData());
+  size_t numSamples = staging.getSize() / sizeof(float);
+  if (normalizationGain != 1.0) {
+    AudioKernels::scale(samples, numSamples, static_cast<float>(normalizationGain));
+  }
+
+  // Interleaved samples are one long channel as far as the encoders care
+  const size_t samplesPerChunk = GlobalSettings::get().getBlockSize() * header.format.numChannels;
+  for (size_t offset = 0; offset < numSamples; offset += samplesPerChunk) {
+    const float* chunk = samples + offset;
+    ulong chunkSamples = static_cast<ulong>(std::min(samplesPerChunk, numSamples - offset));
+    encode<1>(&chunk, 1, chunkSamples);
+    writeData(pcmBuffer.data(), pcmBuffer.size());
+  }
+
+  staging.close();
+  std::error_code error;
+  std::filesystem::remove(stagingFileName, error);
+  return true;
+}
+
+// Float output is normalized where it lies, after the file is complete, and
+// only hashed then
+bool PcmWavFile::rescaleInPlace() {
+  MappedFile mappedFile;
+  if (!mappedFile.open(fileName, true)) {
+    return false;
+  }
+
+  uchar* data = mappedFile.getData() + headerBytesWritten;
+  if (normalizationGain != 1.0) {
+    AudioKernels::scale(reinterpret_cast<float*>(data), dataBytesWritten / sizeof(float),
+      static_cast<float>(normalizationGain));
+  }
+  if (contentHash != nullptr) {
+    contentHash->update(data, dataBytesWritten);
+  }
+  return mappedFile.close();
+}
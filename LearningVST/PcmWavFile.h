@@ -3,18 +3,38 @@
 #include "Types.h"
 #include <string>
 #include <vector>
-#include <sstream>
+#include <fstream>
+#include <memory>
+#include <math.h>
+#include <assert.h>
 #include "SampleBuffer.h"
+#include "AudioKernels.h"
+#include "ContentHash.h"
+#include "WaveformPeaks.h"
+#include "RenderProfiler.h"
+#include "TraceRecorder.h"
 
 enum class AudioBitDepth {
   Type8 = 8,
   Type16 = 16,
   Type24 = 24,
   Type32 = 32,
+  TypeFloat32, // IEEE float
 };
 
+inline ushort getBitsPerSample(AudioBitDepth bitDepth) {
+  return bitDepth == AudioBitDepth::TypeFloat32 ? 32 : static_cast<ushort>(bitDepth);
+}
+
 class PcmWavFile {
 public:
+  static constexpr ushort kFormatPcm = 1;
+  static constexpr ushort kFormatFloat = 3;
+  static constexpr ushort kFormatExtensible = 0xFFFE;
+
+  // Pass to openWrite to pick the usual speaker layout for the channel count
+  static constexpr uint kDefaultChannelMask = 0;
+
 #pragma pack(push, 1)
   // Note that in all situations chunkSize means size after the tag and chunkSize members
   struct PcmHeader {
@@ -27,7 +47,7 @@ public:
     struct PcmFormat {
       char chunkId[4] = { 'f', 'm', 't', ' ' };
       uint chunkSize = 16;
-      ushort format = 1;
+      ushort format = kFormatPcm;
       ushort numChannels = 0;
       uint sampleRate = 0;
       uint byteRate = 0;
@@ -35,6 +55,16 @@ public:
       ushort bitsPerSample = 0;
     } format;
 
+    // Only written for WAVE_FORMAT_EXTENSIBLE, which is required for more than
+    // 2 channels or more than 16 bits; format.chunkSize then includes it
+    struct Extension {
+      ushort size = 22;
+      ushort validBitsPerSample = 0;
+      uint channelMask = 0; // Speaker position of each channel, in order; channels past the last bit have none
+      uchar subFormat[16] = { // KSDATAFORMAT_SUBTYPE_PCM
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    } extension;
+
     struct Data {
       char chunkId[4] = { 'd', 'a', 't', 'a' };
       uint chunkSize = 0;
@@ -48,12 +78,166 @@ protected:
   AudioBitDepth bitDepth;
   std::vector<uchar> pcmBuffer;
   uint dataBytesWritten = 0;
+  uint headerBytesWritten = 0;
   std::string fileName;
-  std::ostringstream ss;
 
-  //std::ofstream *ofs = nullptr;
+  // Written as we go; buffering the whole file in memory meant the stream
+  // kept reallocating as it grew
+  std::ofstream ofs;
+
+  // Peak normalization: we track the peak as we write and apply the gain at
+  // close. Float output is rescaled in place; integer output can't be
+  // rescaled without requantizing, so it's staged as float and quantized once.
+  bool normalize = false;
+  double normalizeTargetPeak = 1.0;
+  double peak = 0.0;
+  double normalizationGain = 1.0;
+  std::string stagingFileName;
+  std::ofstream stagingOfs;
+
+  inline bool isStaging() const {
+    return normalize && bitDepth != AudioBitDepth::TypeFloat32;
+  }
+
+  inline bool isRescalingInPlace() const {
+    return normalize && bitDepth == AudioBitDepth::TypeFloat32;
+  }
+
+  // Hashing the data as it's written, if asked for. Output that's rescaled
+  // in place is hashed once that's done, since it's the final bytes we want.
+  double hashSegmentSeconds = 0.0;
+  std::unique_ptr<ContentHash> contentHash;
+
+  // Waveform overviews, if asked for
+  bool writePeaks = false;
+  std::unique_ptr<WaveformPeaks> waveformPeaks;
+
+  // Everything that goes in the data chunk goes through here
+  inline void writeData(const uchar* data, size_t numBytes) {
+    ofs.write(reinterpret_cast<const char*>(data), numBytes);
+    if (contentHash != nullptr && !isRescalingInPlace()) {
+      contentHash->update(data, numBytes);
+    }
+  }
+
+  // Converts and interleaves into pcmBuffer, in our output format
+  template <ushort kChannels, typename T> void encode(const T* const* channels, ushort numChannels, ulong numFrames);
+  bool quantizeStaging();
+  bool rescaleInPlace();
+
 public:
-  bool openWrite(const std::string& fileName, uint numChannels, uint sampleRate, AudioBitDepth bitDepth);
-  bool writeBuffer(const VstSampleBuffer& sampleBuffer);
+  // Call before openWrite: everything written is scaled at closeWrite so the
+  // loudest sample peaks at targetDbfs
+  void setNormalization(double targetDbfs);
+
+  // Call before openWrite: hashes the data chunk as it's written, with a
+  // digest per segmentSeconds as well, and writes the digests next to the
+  // file (see getContentHashFileName) at closeWrite
+  void setContentHash(double segmentSeconds);
+
+  // Null unless setContentHash was called; complete once closed
+  inline const ContentHash* getContentHash() const {
+    return contentHash.get();
+  }
+
+  // fileName with a .hash.json extension instead
+  static std::string getContentHashFileName(const std::string& fileName);
+
+  // Call before openWrite: writes min/max overviews of the audio next to the
+  // file (see WaveformPeaks) as it's written
+  void setWaveformPeaks();
+
+  // What normalization multiplied the output by, once closed
+  inline double getNormalizationGain() const {
+    return normalizationGain;
+  }
+
+  bool openWrite(const std::string& fileName, uint numChannels, uint sampleRate, AudioBitDepth bitDepth,
+    uint channelMask = kDefaultChannelMask);
+  template <typename T, ushort kChannels> bool writeBuffer(const SampleBuffer<T, kChannels>& sampleBuffer, ulong numFrames);
+  // Same, from one pointer per channel of the file (e.g. a slice of a wider buffer)
+  template <ushort kChannels = kDynamicChannels, typename T> bool writeChannels(const T* const* channels, ulong numFrames);
+  bool writeSilence(ulong numFrames);
   bool closeWrite();
-};
\ No newline at end of file
+
+  // Usual speaker positions for a channel count, as WAVE_FORMAT_EXTENSIBLE
+  // channel mask bits; 0 (unpositioned) for anything wider than 7.1
+  static uint getDefaultChannelMask(uint numChannels);
+};
+
+// Templated on the buffer so the conversion is compiled for each precision and
+// channel count we render with
+template <typename T, ushort kChannels>
+bool PcmWavFile::writeBuffer(const SampleBuffer<T, kChannels>& sampleBuffer, ulong numFrames) {
+  assert(numFrames <= sampleBuffer.getBlockSize());
+  assert(sampleBuffer.getNumChannels() == header.format.numChannels);
+
+  return writeChannels<kChannels>(sampleBuffer.getSamples(), numFrames);
+}
+
+template <ushort kChannels, typename T>
+void PcmWavFile::encode(const T* const* channels, ushort numChannels, ulong numFrames) {
+  auto numSamples = numChannels * numFrames;
+  pcmBuffer.resize(numSamples * (getBitsPerSample(bitDepth) / 8));
+
+  // Maximum value of a PCM sample
+  auto pcmSampleMaxValue = pow(2.0,
+    static_cast<double>(header.format.bitsPerSample - 1)) - 1.0;
+
+  switch (this->bitDepth) {
+    case AudioBitDepth::Type8:
+      AudioKernels::encodePcm8<kChannels>(channels, numChannels,
+        numFrames, pcmSampleMaxValue, pcmBuffer.data());
+      break;
+    case AudioBitDepth::Type16:
+      AudioKernels::encodePcm16<kChannels>(channels, numChannels,
+        numFrames, pcmSampleMaxValue, reinterpret_cast<short*>(pcmBuffer.data()));
+      break;
+    case AudioBitDepth::Type24:
+      AudioKernels::encodePcm24<kChannels>(channels, numChannels,
+        numFrames, pcmSampleMaxValue, pcmBuffer.data());
+      break;
+    case AudioBitDepth::Type32:
+      AudioKernels::encodePcm32<kChannels>(channels, numChannels,
+        numFrames, pcmSampleMaxValue, reinterpret_cast<int*>(pcmBuffer.data()));
+      break;
+    case AudioBitDepth::TypeFloat32:
+      AudioKernels::encodeFloat32<kChannels>(channels, numChannels,
+        numFrames, reinterpret_cast<float*>(pcmBuffer.data()));
+      break;
+  }
+}
+
+template <ushort kChannels, typename T>
+bool PcmWavFile::writeChannels(const T* const* channels, ulong numFrames) {
+  ProfileScope profileScope(RenderStage::FileWrite);
+  TraceScope traceScope("writeBuffer", "numFrames", numFrames);
+  const ushort numChannels = resolveChannelCount<kChannels>(header.format.numChannels);
+  auto numBytesToWrite = numChannels * numFrames * (getBitsPerSample(bitDepth) / 8);
+
+  if (waveformPeaks != nullptr) {
+    waveformPeaks->process(channels, numFrames);
+  }
+
+  if (normalize) {
+    for (ushort c = 0; c < numChannels; ++c) {
+      peak = std::max(peak, static_cast<double>(AudioKernels::peakAbs(channels[c], numFrames)));
+    }
+  }
+
+  if (isStaging()) {
+    // Staged as interleaved float; the size we count is the final one
+    pcmBuffer.resize(numChannels * numFrames * sizeof(float));
+    AudioKernels::encodeFloat32<kChannels>(channels, numChannels,
+      numFrames, reinterpret_cast<float*>(pcmBuffer.data()));
+    stagingOfs.write(reinterpret_cast<char*>(pcmBuffer.data()), pcmBuffer.size());
+  }
+  else {
+    encode<kChannels>(channels, numChannels, numFrames);
+    writeData(pcmBuffer.data(), numBytesToWrite);
+  }
+
+  this->dataBytesWritten += numBytesToWrite;
+
+  return true;
+}
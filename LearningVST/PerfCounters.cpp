@@ -0,0 +1,114 @@
+#include "PerfCounters.h"
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char* PerfCounterGroup::getCounterName(Counter counter) {
+  switch (counter) {
+    case Cycles:
+      return "cycles";
+    case Instructions:
+      return "instructions";
+    case CacheMisses:
+      return "cacheMisses";
+    case BranchMisses:
+      return "branchMisses";
+    default:
+      return "unknown";
+  }
+}
+
+#ifdef __linux__
+bool PerfCounterGroup::open(std::string& error) {
+  close();
+
+  static const uint64_t configs[NumCounters] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+  };
+
+  for (int counter = 0; counter < NumCounters; ++counter) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[counter];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The leader starts the whole group
+    attr.disabled = counter == Cycles ? 1 : 0;
+
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, counter == Cycles ? -1 : fds[Cycles], 0));
+    if (fd < 0) {
+      if (counter == Cycles) {
+        error = strerror(errno);
+        if (errno == EACCES || errno == EPERM) {
+          error += " (see /proc/sys/kernel/perf_event_paranoid)";
+        }
+        else if (errno == ENOENT || errno == EOPNOTSUPP) {
+          error += " (no hardware counters, e.g. in a VM)";
+        }
+        return false;
+      }
+      continue;
+    }
+
+    fds[counter] = fd;
+    slots[counter] = static_cast<int>(numOpened++);
+  }
+
+  ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+void PerfCounterGroup::close() {
+  // Members first, then the leader
+  for (int counter = NumCounters - 1; counter >= 0; --counter) {
+    if (fds[counter] >= 0) {
+      ::close(fds[counter]);
+      fds[counter] = -1;
+    }
+    slots[counter] = -1;
+  }
+  numOpened = 0;
+}
+
+bool PerfCounterGroup::read(Values& values) const {
+  if (!isOpen()) {
+    return false;
+  }
+
+  // PERF_FORMAT_GROUP: how many, then each value in the order they were opened
+  uint64_t buffer[1 + NumCounters];
+  if (::read(fds[Cycles], buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t) * (1 + numOpened))) {
+    return false;
+  }
+
+  for (int counter = 0; counter < NumCounters; ++counter) {
+    values.counts[counter] = slots[counter] >= 0 ? buffer[1 + slots[counter]] : 0;
+  }
+  return true;
+}
+#else
+bool PerfCounterGroup::open(std::string& error) {
+  error = "only supported on Linux";
+  return false;
+}
+
+void PerfCounterGroup::close() {
+}
+
+bool PerfCounterGroup::read(Values& values) const {
+  return false;
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <stdint.h>
+#include "Types.h"
+
+// Hardware performance counters for the calling thread (Linux
+// perf_event_open), read as one group so every counter covers exactly the
+// same instructions. Only user-space work is counted, which is what most
+// systems allow unprivileged. Anywhere counters aren't available (other
+// platforms, VMs without a PMU, perf_event_paranoid too strict) open fails
+// with a reason, and callers carry on without them.
+class PerfCounterGroup {
+public:
+  enum Counter {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    NumCounters
+  };
+
+  struct Values {
+    std::array<uint64_t, NumCounters> counts = { };
+  };
+
+protected:
+  std::array<int, NumCounters> fds;
+  std::array<int, NumCounters> slots; // Position in the group's read buffer; -1 if it didn't open
+  uint numOpened = 0;
+
+public:
+  PerfCounterGroup() {
+    fds.fill(-1);
+    slots.fill(-1);
+  }
+
+  PerfCounterGroup(const PerfCounterGroup&) = delete;
+  PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+  ~PerfCounterGroup() {
+    close();
+  }
+
+  // Cycles have to open; any of the others may not (e.g. no cache events on
+  // some VMs) and then read as 0. On failure, error says why.
+  bool open(std::string& error);
+  void close();
+
+  inline bool isOpen() const {
+    return fds[Cycles] >= 0;
+  }
+
+  inline bool hasCounter(Counter counter) const {
+    return slots[counter] >= 0;
+  }
+
+  // Counts so far; subtract two reads to get what happened in between
+  bool read(Values& values) const;
+
+  static const char* getCounterName(Counter counter);
+};
@@ -0,0 +1,94 @@
+#include "PluginLibrary.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#include <filesystem>
+#endif
+
+#ifdef _WIN32
+// GetLastError's code as text
+static std::string getLastErrorString() {
+  DWORD error = GetLastError();
+  if (error) {
+    LPVOID lpMsgBuf;
+    DWORD bufLen = FormatMessageA(
+      FORMAT_MESSAGE_ALLOCATE_BUFFER |
+      FORMAT_MESSAGE_FROM_SYSTEM |
+      FORMAT_MESSAGE_IGNORE_INSERTS,
+      NULL,
+      error,
+      MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+      (LPSTR)&lpMsgBuf,
+      0, NULL);
+    if (bufLen) {
+      LPCSTR lpMsgStr = (LPCSTR)lpMsgBuf;
+      std::string result(lpMsgStr, lpMsgStr + bufLen);
+
+      LocalFree(lpMsgBuf);
+
+      return result;
+    }
+  }
+  return std::string();
+}
+
+bool PluginLibrary::open(const std::string& fileName) {
+  close();
+
+  handle = LoadLibraryExA(fileName.c_str(), nullptr, LOAD_WITH_ALTERED_SEARCH_PATH);
+  if (handle == nullptr) {
+    lastError = getLastErrorString();
+    return false;
+  }
+  lastError.clear();
+  return true;
+}
+
+void PluginLibrary::close() {
+  if (handle != nullptr) {
+    FreeLibrary(static_cast<HMODULE>(handle));
+    handle = nullptr;
+  }
+}
+
+void* PluginLibrary::getSymbol(const std::string& name) {
+  if (handle == nullptr) {
+    return nullptr;
+  }
+  return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(handle), name.c_str()));
+}
+#else
+bool PluginLibrary::open(const std::string& fileName) {
+  close();
+
+  // A bare file name would be looked for on the library path instead of here.
+  // Symbols stay local so two plugins built from the same framework can't
+  // resolve to each other's copies.
+  std::error_code error;
+  std::filesystem::path path = std::filesystem::absolute(fileName, error);
+  handle = dlopen(error ? fileName.c_str() : path.string().c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    const char* message = dlerror();
+    lastError = message != nullptr ? message : "";
+    return false;
+  }
+  lastError.clear();
+  return true;
+}
+
+void PluginLibrary::close() {
+  if (handle != nullptr) {
+    dlclose(handle);
+    handle = nullptr;
+  }
+}
+
+void* PluginLibrary::getSymbol(const std::string& name) {
+  if (handle == nullptr) {
+    return nullptr;
+  }
+  return dlsym(handle, name.c_str());
+}
+#endif
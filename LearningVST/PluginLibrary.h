@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include "Types.h"
+
+// A plugin binary loaded into the process: a DLL through LoadLibraryEx on
+// Windows, a shared object through dlopen elsewhere. The binary stays loaded
+// until close, as anything it returned (an AEffect, say) lives in it.
+class PluginLibrary {
+protected:
+  void* handle = nullptr; // HMODULE on Windows
+  std::string lastError;
+
+public:
+  PluginLibrary() {
+  }
+
+  PluginLibrary(const PluginLibrary&) = delete;
+  PluginLibrary& operator=(const PluginLibrary&) = delete;
+
+  ~PluginLibrary() {
+    close();
+  }
+
+  // On Windows the DLL's own dependencies are looked for next to it first;
+  // shared objects find theirs through their RPATH/RUNPATH as usual
+  bool open(const std::string& fileName);
+  void close();
+
+  inline bool isOpen() const {
+    return handle != nullptr;
+  }
+
+  // Address of an exported function or variable, or nullptr
+  void* getSymbol(const std::string& name);
+
+  // The first of names that's exported, or nullptr
+  template <size_t kNumNames> void* findSymbol(const std::string (&names)[kNumNames]) {
+    for (const auto& name : names) {
+      void* symbol = getSymbol(name);
+      if (symbol != nullptr) {
+        return symbol;
+      }
+    }
+    return nullptr;
+  }
+
+  // Why the last open failed, in the system's words
+  inline const std::string& getLastError() const {
+    return lastError;
+  }
+};
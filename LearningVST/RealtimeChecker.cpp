@@ -0,0 +1,385 @@
+#include "RealtimeChecker.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <errno.h>
+#include <execinfo.h>
+#endif
+
+#if REALTIME_CHECKER_BLOCKING_HOOK
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <crtdbg.h>
+#include <DbgHelp.h>
+#pragma comment(lib, "dbghelp.lib")
+#endif
+
+#ifdef _MSC_VER
+#define REALTIME_CHECKER_NOINLINE __declspec(noinline)
+#else
+#define REALTIME_CHECKER_NOINLINE __attribute__((noinline))
+#endif
+
+namespace {
+  struct ThreadState {
+    bool realtime = false;
+    bool inHook = false; // Whatever the checker itself does isn't checked
+  };
+
+  ThreadState& getThreadState() {
+    thread_local ThreadState threadState;
+    return threadState;
+  }
+
+  const char* getViolationName(RealtimeChecker::Violation violation) {
+    switch (violation) {
+      case RealtimeChecker::Violation::Allocation:
+        return "allocation";
+      case RealtimeChecker::Violation::Free:
+        return "free";
+      case RealtimeChecker::Violation::Blocking:
+        return "blocking call";
+      default:
+        return "unknown";
+    }
+  }
+
+  // Stacks start at the hook (malloc, pthread_mutex_lock and so on), so
+  // the frames in between mustn't be inlined away
+  constexpr int kMaxSkipFrames = 4;
+
+  // Skips this and numSkipFrames - 1 of its callers
+  REALTIME_CHECKER_NOINLINE int captureStack(void** frames, int maxFrames, int numSkipFrames) {
+#if defined(__GLIBC__)
+    void* allFrames[RealtimeChecker::kMaxFrames + kMaxSkipFrames];
+    int numFrames = backtrace(allFrames, maxFrames + numSkipFrames);
+    numFrames = std::max(numFrames - numSkipFrames, 0);
+    memcpy(frames, allFrames + numSkipFrames, numFrames * sizeof(void*));
+    return numFrames;
+#elif defined(_WIN32)
+    return CaptureStackBackTrace(numSkipFrames, maxFrames, frames, nullptr);
+#else
+    return 0;
+#endif
+  }
+
+  void printFrames(std::ostream& os, void* const* frames, int numFrames) {
+#if defined(__GLIBC__)
+    char** symbols = backtrace_symbols(frames, numFrames);
+    for (int i = 0; i < numFrames; ++i) {
+      os << "    #" << i << " " << (symbols != nullptr ? symbols[i] : "?") << std::endl;
+    }
+    free(symbols);
+#elif defined(_WIN32)
+    HANDLE process = GetCurrentProcess();
+    static bool symbolsLoaded = SymInitialize(process, nullptr, TRUE) != FALSE;
+
+    alignas(SYMBOL_INFO) char symbolMemory[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    SYMBOL_INFO* symbol = reinterpret_cast<SYMBOL_INFO*>(symbolMemory);
+    for (int i = 0; i < numFrames; ++i) {
+      DWORD64 address = reinterpret_cast<DWORD64>(frames[i]);
+      os << "    #" << i << " 0x" << std::hex << address << std::dec;
+
+      memset(symbol, 0, sizeof(SYMBOL_INFO));
+      symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+      symbol->MaxNameLen = MAX_SYM_NAME;
+      if (symbolsLoaded && SymFromAddr(process, address, nullptr, symbol)) {
+        os << " " << symbol->Name;
+
+        IMAGEHLP_LINE64 line = { };
+        line.SizeOfStruct = sizeof(line);
+        DWORD displacement = 0;
+        if (SymGetLineFromAddr64(process, address, &displacement, &line)) {
+          os << " (" << line.FileName << ":" << line.LineNumber << ")";
+        }
+      }
+      os << std::endl;
+    }
+#else
+    (void)frames;
+    if (numFrames == 0) {
+      os << "    (no stack traces on this platform)" << std::endl;
+    }
+#endif
+  }
+}
+
+#if defined(_DEBUG) && defined(_WIN32)
+// The debug CRT sees every malloc, free and operator new
+static int crtAllocHook(int allocType, void*, size_t, int blockType, long, const unsigned char*, int) {
+  if (blockType != _CRT_BLOCK) {
+    RealtimeChecker::check(allocType == _HOOK_FREE ?
+      RealtimeChecker::Violation::Free : RealtimeChecker::Violation::Allocation);
+  }
+  return TRUE;
+}
+#endif
+
+bool RealtimeChecker::isAvailable() {
+#ifdef _DEBUG
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool RealtimeChecker::canCheckBlocking() {
+  return REALTIME_CHECKER_BLOCKING_HOOK != 0;
+}
+
+void RealtimeChecker::setMode(Mode mode, bool checkBlocking) {
+  this->checkBlocking = checkBlocking && canCheckBlocking();
+
+#ifdef __GLIBC__
+  // The first backtrace loads libgcc, which allocates
+  void* frame;
+  backtrace(&frame, 1);
+#endif
+#if defined(_DEBUG) && defined(_WIN32)
+  if (mode != Mode::Off) {
+    _CrtSetAllocHook(crtAllocHook);
+  }
+#endif
+
+  this->mode.store(mode, std::memory_order_relaxed);
+}
+
+bool RealtimeChecker::isRealtimeThread() {
+  return getThreadState().realtime;
+}
+
+void RealtimeChecker::setRealtimeThread(bool realtime) {
+  getThreadState().realtime = realtime;
+}
+
+REALTIME_CHECKER_NOINLINE void RealtimeChecker::check(Violation violation, const char* call) {
+  // The thread state comes first: the checker is only ever created off the
+  // real-time thread, before anything is checked
+  ThreadState& threadState = getThreadState();
+  if (!threadState.realtime || threadState.inHook) {
+    return;
+  }
+
+  RealtimeChecker& checker = get();
+  Mode mode = checker.mode.load(std::memory_order_relaxed);
+  if (mode == Mode::Off || (violation == Violation::Blocking && !checker.checkBlocking)) {
+    return;
+  }
+
+  threadState.inHook = true;
+  checker.counts[static_cast<int>(violation)].fetch_add(1, std::memory_order_relaxed);
+
+  if (mode == Mode::Abort) {
+    void* frames[kMaxFrames];
+    int numFrames = captureStack(frames, kMaxFrames, 2);
+    std::cerr << "Real-time violation: " << getViolationName(violation);
+    if (call != nullptr) {
+      std::cerr << " (" << call << ")";
+    }
+    std::cerr << " on the render thread" << std::endl;
+    printFrames(std::cerr, frames, numFrames);
+    abort();
+  }
+
+  checker.recordStack(violation, call);
+  threadState.inHook = false;
+}
+
+REALTIME_CHECKER_NOINLINE void RealtimeChecker::recordStack(Violation violation, const char* call) {
+  void* frames[kMaxFrames];
+  int numFrames = captureStack(frames, kMaxFrames, 3);
+
+  // FNV-1a over the frames and what happened; never 0, which marks a free slot
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&hash](uint64_t value) {
+    hash = (hash ^ value) * 1099511628211ULL;
+  };
+  mix(static_cast<uint64_t>(violation));
+  mix(reinterpret_cast<uintptr_t>(call));
+  for (int i = 0; i < numFrames; ++i) {
+    mix(reinterpret_cast<uintptr_t>(frames[i]));
+  }
+  hash |= 1;
+
+  for (Stack& stack : stacks) {
+    uint64_t stackHash = stack.hash.load(std::memory_order_acquire);
+    if (stackHash == 0) {
+      if (stack.hash.compare_exchange_strong(stackHash, hash, std::memory_order_acq_rel)) {
+        stack.violation = violation;
+        stack.call = call;
+        memcpy(stack.frames, frames, numFrames * sizeof(void*));
+        stack.numFrames = numFrames;
+        stack.ready.store(true, std::memory_order_release);
+        stack.count.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      // Someone else just took it; stackHash now holds theirs
+    }
+    if (stackHash == hash) {
+      stack.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  numUntracked.fetch_add(1, std::memory_order_relaxed);
+}
+
+ulong RealtimeChecker::getTotalCount() const {
+  ulong total = 0;
+  for (const auto& count : counts) {
+    total += count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void RealtimeChecker::printReport(std::ostream& os) const {
+  os << "Real-time violations in render loop: " <<
+    getCount(Violation::Allocation) << " allocations, " <<
+    getCount(Violation::Free) << " frees";
+  if (checkBlocking) {
+    os << ", " << getCount(Violation::Blocking) << " blocking calls";
+  }
+  os << std::endl;
+
+  std::vector<const Stack*> recorded;
+  for (const Stack& stack : stacks) {
+    if (stack.ready.load(std::memory_order_acquire)) {
+      recorded.push_back(&stack);
+    }
+  }
+  std::stable_sort(recorded.begin(), recorded.end(), [](const Stack* a, const Stack* b) {
+    return a->count.load(std::memory_order_relaxed) > b->count.load(std::memory_order_relaxed);
+  });
+
+  for (const Stack* stack : recorded) {
+    os << "  " << stack->count.load(std::memory_order_relaxed) << "x " << getViolationName(stack->violation);
+    if (stack->call != nullptr) {
+      os << " (" << stack->call << ")";
+    }
+    os << ":" << std::endl;
+    printFrames(os, stack->frames, stack->numFrames);
+  }
+
+  ulong untracked = numUntracked.load(std::memory_order_relaxed);
+  if (untracked > 0) {
+    os << "  " << untracked << " more from stacks beyond the first " << kMaxStacks << std::endl;
+  }
+}
+
+#if REALTIME_CHECKER_MALLOC_HOOK && defined(__GLIBC__)
+// glibc's own entry points, so ours can stand in for the public ones
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void __libc_free(void* p);
+  void* __libc_memalign(size_t alignment, size_t size);
+
+  void* malloc(size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* p, size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    return __libc_realloc(p, size);
+  }
+
+  // The aligned family, which aligned operator new goes through, all ends up
+  // in memalign
+  void* memalign(size_t alignment, size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    return __libc_memalign(alignment, size);
+  }
+
+  void* aligned_alloc(size_t alignment, size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void** p, size_t alignment, size_t size) {
+    // A power of two multiple of sizeof(void*), as glibc checks it
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+      return EINVAL;
+    }
+    RealtimeChecker::check(RealtimeChecker::Violation::Allocation);
+    void* memory = __libc_memalign(alignment, size);
+    if (memory == nullptr) {
+      return ENOMEM;
+    }
+    *p = memory;
+    return 0;
+  }
+
+  void free(void* p) {
+    if (p != nullptr) {
+      RealtimeChecker::check(RealtimeChecker::Violation::Free);
+    }
+    __libc_free(p);
+  }
+}
+#endif
+
+#if REALTIME_CHECKER_BLOCKING_HOOK
+// Looked up on first use; a plain atomic, since a guarded static could itself
+// end up locking a mutex
+template <typename Function> static Function getNext(std::atomic<Function>& next, const char* name) {
+  Function function = next.load(std::memory_order_relaxed);
+  if (function == nullptr) {
+    function = reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+    next.store(function, std::memory_order_relaxed);
+  }
+  return function;
+}
+
+extern "C" {
+  ssize_t write(int fd, const void* data, size_t size) {
+    RealtimeChecker::check(RealtimeChecker::Violation::Blocking, "write");
+    return syscall(SYS_write, fd, data, size);
+  }
+
+  int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    typedef int (*Function)(pthread_mutex_t*);
+    static std::atomic<Function> next { nullptr };
+    RealtimeChecker::check(RealtimeChecker::Violation::Blocking, "pthread_mutex_lock");
+    return getNext(next, "pthread_mutex_lock")(mutex);
+  }
+
+  int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex) {
+    typedef int (*Function)(pthread_cond_t*, pthread_mutex_t*);
+    static std::atomic<Function> next { nullptr };
+    RealtimeChecker::check(RealtimeChecker::Violation::Blocking, "pthread_cond_wait");
+    return getNext(next, "pthread_cond_wait")(condition, mutex);
+  }
+
+  int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time) {
+    typedef int (*Function)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
+    static std::atomic<Function> next { nullptr };
+    RealtimeChecker::check(RealtimeChecker::Violation::Blocking, "pthread_cond_timedwait");
+    return getNext(next, "pthread_cond_timedwait")(condition, mutex, time);
+  }
+
+  int nanosleep(const struct timespec* duration, struct timespec* remaining) {
+    typedef int (*Function)(const struct timespec*, struct timespec*);
+    static std::atomic<Function> next { nullptr };
+    RealtimeChecker::check(RealtimeChecker::Violation::Blocking, "nanosleep");
+    return getNext(next, "nanosleep")(duration, remaining);
+  }
+}
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+#include "Types.h"
+
+// Whether allocations are caught below operator new, see below
+#if defined(_DEBUG) && (defined(__GLIBC__) || defined(_WIN32))
+#define REALTIME_CHECKER_MALLOC_HOOK 1
+#else
+#define REALTIME_CHECKER_MALLOC_HOOK 0
+#endif
+
+#if defined(_DEBUG) && defined(__GLIBC__)
+#define REALTIME_CHECKER_BLOCKING_HOOK 1
+#else
+#define REALTIME_CHECKER_BLOCKING_HOOK 0
+#endif
+
+// Catches the render thread doing things a real-time thread mustn't: heap
+// allocation, freeing, and (optionally) blocking calls such as locking a
+// mutex, waiting on a condition or writing to a file. The render loop marks
+// itself real-time with RealtimeScope; anything caught while it's marked is
+// counted, with the call stack, or aborts on the spot.
+//
+// The hooks are only compiled into debug builds, alongside AllocationCounter's
+// operator new. Allocations are caught at the malloc level (glibc's malloc
+// family, or the debug CRT's allocation hook on Windows) so plugins' own
+// allocations are caught too; elsewhere only operator new is. Blocking calls
+// can only be intercepted on Linux, where the executable's own write,
+// pthread_mutex_lock, pthread_cond_wait/timedwait and nanosleep stand in for
+// libc's.
+class RealtimeChecker {
+public:
+  enum class Mode {
+    Off,
+    Count, // Count and report at the end of the render
+    Abort, // Print the stack and abort at the first violation
+  };
+
+  enum class Violation {
+    Allocation,
+    Free,
+    Blocking,
+    NumViolations
+  };
+
+  static constexpr size_t kMaxStacks = 64; // Distinct call stacks kept
+  static constexpr int kMaxFrames = 24;
+
+protected:
+  struct Stack {
+    std::atomic<uint64_t> hash { 0 }; // 0 while free
+    std::atomic<bool> ready { false }; // Frames written
+    Violation violation = Violation::Allocation;
+    const char* call = nullptr; // For blocking calls, e.g. "pthread_mutex_lock"
+    void* frames[kMaxFrames];
+    int numFrames = 0;
+    std::atomic<ulong> count { 0 };
+  };
+
+  std::atomic<Mode> mode { Mode::Off };
+  bool checkBlocking = false;
+  std::atomic<ulong> counts[static_cast<int>(Violation::NumViolations)] = { };
+  std::atomic<ulong> numUntracked { 0 }; // Violations whose stack didn't fit
+  Stack stacks[kMaxStacks];
+
+  RealtimeChecker() {
+  }
+
+  void recordStack(Violation violation, const char* call);
+
+public:
+  static RealtimeChecker& get() {
+    static RealtimeChecker realtimeChecker;
+    return realtimeChecker;
+  }
+
+  // Whether this build has the hooks at all
+  static bool isAvailable();
+
+  // Whether blocking calls can be intercepted here
+  static bool canCheckBlocking();
+
+  void setMode(Mode mode, bool checkBlocking);
+
+  inline bool isEnabled() const {
+    return mode.load(std::memory_order_relaxed) != Mode::Off;
+  }
+
+  inline bool isCheckingBlocking() const {
+    return checkBlocking;
+  }
+
+  // Whether the calling thread is currently marked real-time
+  static bool isRealtimeThread();
+  static void setRealtimeThread(bool realtime);
+
+  // Called by the hooks. Does nothing unless checking and on a real-time
+  // thread; call names blocking calls.
+  static void check(Violation violation, const char* call = nullptr);
+
+  inline ulong getCount(Violation violation) const {
+    return counts[static_cast<int>(violation)].load(std::memory_order_relaxed);
+  }
+
+  ulong getTotalCount() const;
+
+  // Counts, then each distinct stack with how often it was hit. Symbol
+  // lookup allocates, so only call this once the render is done.
+  void printReport(std::ostream& os) const;
+};
+
+// Marks the calling thread real-time until it goes out of scope
+class RealtimeScope {
+protected:
+  bool wasRealtime;
+
+public:
+  inline RealtimeScope(bool realtime = true) {
+    wasRealtime = RealtimeChecker::isRealtimeThread();
+    RealtimeChecker::setRealtimeThread(realtime);
+  }
+
+  RealtimeScope(const RealtimeScope&) = delete;
+  RealtimeScope& operator=(const RealtimeScope&) = delete;
+
+  inline ~RealtimeScope() {
+    RealtimeChecker::setRealtimeThread(wasRealtime);
+  }
+};
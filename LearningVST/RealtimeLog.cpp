@@ -0,0 +1,141 @@
+#include "RealtimeLog.h"
+#include <iostream>
+#include <chrono>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+
+static_assert((RealtimeLog::kCapacity & (RealtimeLog::kCapacity - 1)) == 0, "Log capacity must be a power of two");
+
+RealtimeLog::RealtimeLog() {
+  for (size_t i = 0; i < kCapacity; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+RealtimeLog::~RealtimeLog() {
+  stop();
+}
+
+uint64_t RealtimeLog::now() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void RealtimeLog::setRepeatInterval(double seconds) {
+  repeatNanoseconds = static_cast<uint64_t>(std::max(seconds, 0.0) * 1e9);
+}
+
+void RealtimeLog::start() {
+  if (running.exchange(true)) {
+    return;
+  }
+  drainThread = std::thread([this]() {
+    while (running.load(std::memory_order_acquire)) {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(kDrainIntervalMs));
+    }
+  });
+}
+
+void RealtimeLog::stop() {
+  if (running.exchange(false)) {
+    drainThread.join();
+  }
+  drain();
+  writeSuppressed();
+
+  ulong dropped = numDropped.exchange(0);
+  if (dropped > 0) {
+    std::cerr << dropped << " log messages dropped; they came faster than they could be written" << std::endl;
+  }
+}
+
+void RealtimeLog::log(const char* format, ...) {
+  // Claim a slot; it's free once its sequence has caught up with the position
+  uint64_t position = writePosition.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &slots[position & (kCapacity - 1)];
+    uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    int64_t difference = static_cast<int64_t>(sequence - position);
+    if (difference == 0) {
+      if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    else if (difference < 0) {
+      // Still waiting to be drained
+      numDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else {
+      position = writePosition.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->format = format;
+  slot->time = now();
+  va_list args;
+  va_start(args, format);
+  vsnprintf(slot->message, kMaxMessageLength, format, args);
+  va_end(args);
+
+  slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+RealtimeLog::Source* RealtimeLog::findSource(const char* format) {
+  for (Source& source : sources) {
+    if (source.format == format) {
+      return &source;
+    }
+    if (source.format == nullptr) {
+      source.format = format;
+      return &source;
+    }
+  }
+  return nullptr; // Too many kinds of message; these aren't rate-limited
+}
+
+void RealtimeLog::drain() {
+  for (;;) {
+    Slot& slot = slots[readPosition & (kCapacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != readPosition + 1) {
+      return;
+    }
+
+    Source* source = findSource(slot.format);
+    if (source != nullptr && source->lastWritten != 0 && slot.time - source->lastWritten < repeatNanoseconds) {
+      ++source->numSuppressed;
+      memcpy(source->lastSuppressed, slot.message, kMaxMessageLength);
+    }
+    else {
+      std::cerr << slot.message;
+      if (source != nullptr) {
+        if (source->numSuppressed > 0) {
+          std::cerr << " (" << source->numSuppressed << " more like this since the last one shown)";
+          source->numSuppressed = 0;
+        }
+        source->lastWritten = slot.time;
+      }
+      std::cerr << std::endl;
+    }
+
+    slot.sequence.store(readPosition + kCapacity, std::memory_order_release);
+    ++readPosition;
+  }
+}
+
+void RealtimeLog::writeSuppressed() {
+  for (Source& source : sources) {
+    if (source.numSuppressed > 0) {
+      std::cerr << source.lastSuppressed;
+      if (source.numSuppressed > 1) {
+        std::cerr << " (" << source.numSuppressed - 1 << " more like this since the last one shown)";
+      }
+      std::cerr << std::endl;
+      source.numSuppressed = 0;
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include "Types.h"
+
+// Diagnostics from the render loop and from plugin callbacks. std::cerr takes
+// a lock and makes a syscall per line, so anything that can go wrong mid-render
+// logs here instead: the message is formatted straight into a preallocated
+// slot, with no locks or allocation, and a background thread writes it to
+// stderr. Repeats of a message (same format string) within the repeat interval
+// are counted rather than written, so a misbehaving plugin can't flood the
+// output either.
+//
+// Any number of threads can log at once. If the ring fills before the drain
+// thread catches up, messages are dropped and counted.
+class RealtimeLog {
+public:
+  static constexpr size_t kCapacity = 1024; // Power of two
+  static constexpr size_t kMaxMessageLength = 160; // Including the terminator; longer messages are cut short
+  static constexpr size_t kMaxSources = 64; // Distinct format strings rate-limited separately
+  static constexpr uint kDrainIntervalMs = 10;
+
+protected:
+  struct Slot {
+    std::atomic<uint64_t> sequence; // position + 1 once written, position + kCapacity once read
+    const char* format;
+    uint64_t time; // Steady clock nanoseconds
+    char message[kMaxMessageLength];
+  };
+
+  // Only touched by whoever is draining
+  struct Source {
+    const char* format = nullptr;
+    uint64_t lastWritten = 0;
+    ulong numSuppressed = 0;
+    char lastSuppressed[kMaxMessageLength];
+  };
+
+  Slot slots[kCapacity];
+  std::atomic<uint64_t> writePosition { 0 };
+  uint64_t readPosition = 0;
+  std::atomic<ulong> numDropped { 0 };
+  Source sources[kMaxSources];
+  uint64_t repeatNanoseconds = 1000000000;
+
+  std::thread drainThread;
+  std::atomic<bool> running { false };
+
+  RealtimeLog();
+  ~RealtimeLog();
+
+  static uint64_t now();
+  Source* findSource(const char* format);
+  void drain();
+  void writeSuppressed();
+
+public:
+  static RealtimeLog& get() {
+    static RealtimeLog realtimeLog;
+    return realtimeLog;
+  }
+
+  // How long after writing a message its repeats are only counted
+  void setRepeatInterval(double seconds);
+
+  // Starts the drain thread. Messages logged before this wait for it.
+  void start();
+
+  // Writes out everything still queued, including counts of suppressed
+  // repeats and dropped messages, and stops the drain thread
+  void stop();
+
+  // printf style; format must be a string literal (its address identifies
+  // the message for rate limiting). Safe to call from the audio thread.
+  void log(const char* format, ...);
+};
@@ -0,0 +1,347 @@
+#include "ReferenceInstrument.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const char* kVendorString = "Dry Cactus";
+
+bool ReferenceInstrument::parseFault(const std::string& name, Fault& fault) {
+  if (name == "none") {
+    fault = Fault::None;
+  }
+  else if (name == "allocate") {
+    fault = Fault::Allocate;
+  }
+  else if (name == "sleep") {
+    fault = Fault::Sleep;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+const std::vector<float>& ReferenceInstrument::getSineTable() {
+  static const std::vector<float> table = [] {
+    std::vector<float> table(kTableSize + 1);
+    for (uint i = 0; i <= kTableSize; ++i) {
+      table[i] = static_cast<float>(sin(2.0 * M_PI * i / kTableSize));
+    }
+    return table;
+  }();
+  return table;
+}
+
+AEffect* ReferenceInstrument::create(const Settings& settings, audioMasterCallback hostCallback) {
+  return &(new ReferenceInstrument(settings, hostCallback))->effect;
+}
+
+ReferenceInstrument::ReferenceInstrument(const Settings& settings, audioMasterCallback hostCallback) {
+  this->settings = settings;
+  this->hostCallback = hostCallback;
+
+  // Everything the process call touches is sized here, never there
+  getSineTable();
+  voices.resize(std::max(settings.maxVoices, 1u));
+  pendingEvents.resize(kMaxEventsPerBlock);
+  updateEnvelope();
+
+  memset(&effect, 0, sizeof(effect));
+  effect.magic = kEffectMagic;
+  effect.dispatcher = dispatcherProc;
+  effect.setParameter = setParameterProc;
+  effect.getParameter = getParameterProc;
+  effect.numPrograms = 0;
+  effect.numParams = 0;
+  effect.numInputs = 0;
+  effect.numOutputs = settings.numOutputs;
+  effect.flags = effFlagsIsSynth | effFlagsCanReplacing | effFlagsCanDoubleReplacing | effFlagsNoSoundInStop;
+  effect.object = this;
+  effect.uniqueID = ('L' << 24) | ('V' << 16) | ('R' << 8) | 'f';
+  effect.version = 1;
+  effect.processReplacing = processReplacingProc;
+  effect.processDoubleReplacing = processDoubleReplacingProc;
+}
+
+void ReferenceInstrument::updateEnvelope() {
+  // A fixed 5ms attack so notes don't click; release as configured
+  attackStep = 1.0 / std::max(0.005 * sampleRate, 1.0);
+  releaseStep = 1.0 / std::max(settings.releaseSeconds * sampleRate, 1.0);
+}
+
+void ReferenceInstrument::noteOn(int key, int velocity) {
+  // A free voice, or else the oldest
+  Voice* voice = &voices[0];
+  for (auto& candidate : voices) {
+    if (candidate.key < 0) {
+      voice = &candidate;
+      break;
+    }
+    if (candidate.age < voice->age) {
+      voice = &candidate;
+    }
+  }
+
+  voice->key = key;
+  voice->released = false;
+  voice->age = ++numNotesStarted;
+  voice->phase = 0.0;
+  voice->increment = 440.0 * pow(2.0, (key - 69) / 12.0) / sampleRate;
+  voice->level = 0.0;
+  // A share of full scale per voice, so even every voice at full velocity
+  // stays below 0 dBFS (the integer encoders don't clamp)
+  voice->target = velocity / (127.0 * voices.size());
+}
+
+void ReferenceInstrument::noteOff(int key) {
+  for (auto& voice : voices) {
+    if (voice.key == key && !voice.released) {
+      voice.released = true;
+      voice.target = 0.0;
+    }
+  }
+}
+
+void ReferenceInstrument::allNotesOff(bool immediately) {
+  for (auto& voice : voices) {
+    voice.released = true;
+    voice.target = 0.0;
+    if (immediately) {
+      voice.key = -1;
+      voice.level = 0.0;
+    }
+  }
+}
+
+void ReferenceInstrument::handleMidiEvent(const VstMidiEvent& midiEvent) {
+  int status = midiEvent.midiData[0] & 0xF0;
+  int data1 = midiEvent.midiData[1] & 0x7F;
+  int data2 = midiEvent.midiData[2] & 0x7F;
+
+  switch (status) {
+    case 0x90:
+      if (data2 > 0) {
+        noteOn(data1, data2);
+        break;
+      }
+      // Note on at velocity 0 is a note off
+      [[fallthrough]];
+    case 0x80:
+      noteOff(data1);
+      break;
+
+    case 0xB0:
+      // All sound off, all notes off (and the omni/mono/poly changes that imply it)
+      if (data1 == 0x78) {
+        allNotesOff(true);
+      }
+      else if (data1 >= 0x7B) {
+        allNotesOff(false);
+      }
+      break;
+  }
+}
+
+void ReferenceInstrument::injectFault() {
+  if (settings.fault == Fault::None || numBlocks % std::max(settings.faultEveryBlocks, 1u) != 0) {
+    return;
+  }
+
+  if (settings.fault == Fault::Allocate) {
+    // Through a volatile pointer so the compiler can't drop the pair
+    void* (*volatile allocate)(size_t) = malloc;
+    void* memory = allocate(settings.allocationBytes);
+    if (memory != nullptr) {
+      memset(memory, 0, settings.allocationBytes);
+    }
+    free(memory);
+  }
+  else if (settings.fault == Fault::Sleep) {
+    std::this_thread::sleep_for(std::chrono::microseconds(settings.sleepMicroseconds));
+  }
+}
+
+template <typename T> void ReferenceInstrument::render(T** outputs, ulong startFrame, ulong endFrame) {
+  if (startFrame >= endFrame) {
+    return;
+  }
+
+  const float* table = getSineTable().data();
+  T* mix = outputs[0];
+  std::fill(mix + startFrame, mix + endFrame, static_cast<T>(0));
+
+  for (auto& voice : voices) {
+    if (voice.key < 0) {
+      continue;
+    }
+
+    for (ulong frame = startFrame; frame < endFrame; ++frame) {
+      double position = voice.phase * kTableSize;
+      uint index = static_cast<uint>(position);
+      double fraction = position - index;
+      double sample = table[index] + fraction * (table[index + 1] - table[index]);
+
+      // The burn is a chain of dependent multiply-adds, so it can't be
+      // vectorized or hoisted; it's folded into the output far below audibility
+      double burn = voice.burn;
+      for (uint i = 0; i < settings.burnPerVoice; ++i) {
+        burn = burn * 0.999999 + 1e-9;
+      }
+      voice.burn = burn;
+
+      mix[frame] += static_cast<T>(sample * voice.level + burn * 1e-12);
+
+      voice.phase += voice.increment;
+      if (voice.phase >= 1.0) {
+        voice.phase -= 1.0;
+      }
+      if (voice.level < voice.target) {
+        voice.level = std::min(voice.level + attackStep, voice.target);
+      }
+      else if (voice.level > voice.target) {
+        voice.level = std::max(voice.level - releaseStep, voice.target);
+      }
+    }
+
+    if (voice.released && voice.level <= 0.0) {
+      voice.key = -1;
+    }
+  }
+
+  for (int c = 1; c < settings.numOutputs; ++c) {
+    std::copy(mix + startFrame, mix + endFrame, outputs[c] + startFrame);
+  }
+}
+
+template <typename T> void ReferenceInstrument::process(T** outputs, VstInt32 numFrames) {
+  // Most instruments ask for the transport every block
+  if (hostCallback != nullptr) {
+    hostCallback(&effect, audioMasterGetTime, 0, kVstTempoValid | kVstPpqPosValid, nullptr, 0.0f);
+  }
+
+  injectFault();
+  ++numBlocks;
+
+  // Render up to each event, then apply it, so events land on their frame
+  ulong endFrame = static_cast<ulong>(std::max(numFrames, 0));
+  ulong frame = 0;
+  for (size_t i = 0; i < numPendingEvents; ++i) {
+    const VstMidiEvent& midiEvent = pendingEvents[i];
+    ulong eventFrame = std::min(static_cast<ulong>(std::max(midiEvent.deltaFrames, 0)), endFrame);
+    if (eventFrame > frame) {
+      render(outputs, frame, eventFrame);
+      frame = eventFrame;
+    }
+    handleMidiEvent(midiEvent);
+  }
+  render(outputs, frame, endFrame);
+
+  numPendingEvents = 0;
+}
+
+VstIntPtr ReferenceInstrument::dispatch(VstInt32 opCode, VstInt32, VstIntPtr, void* ptr, float opt) {
+  switch (opCode) {
+    case effClose:
+      delete this;
+      return 1;
+
+    case effSetSampleRate:
+      if (opt > 0.0f) {
+        sampleRate = opt;
+        updateEnvelope();
+      }
+      return 0;
+
+    case effMainsChanged:
+      // Start from silence on resume and suspend alike
+      allNotesOff(true);
+      numPendingEvents = 0;
+      return 0;
+
+    case effProcessEvents: {
+      auto events = static_cast<VstEvents*>(ptr);
+      if (events == nullptr) {
+        return 0;
+      }
+      for (VstInt32 i = 0; i < events->numEvents && numPendingEvents < pendingEvents.size(); ++i) {
+        if (events->events[i]->type == kVstMidiType) {
+          pendingEvents[numPendingEvents++] = *reinterpret_cast<VstMidiEvent*>(events->events[i]);
+        }
+      }
+      return 1;
+    }
+
+    case effGetPlugCategory:
+      return kPlugCategSynth;
+
+    case effSetSpeakerArrangement:
+      // Whatever the host lays out; every output carries the same signal
+      return 1;
+
+    case effGetEffectName:
+      strncpy(static_cast<char*>(ptr), kName, kVstMaxEffectNameLen - 1);
+      return 1;
+
+    case effGetVendorString:
+      strncpy(static_cast<char*>(ptr), kVendorString, kVstMaxVendorStrLen - 1);
+      return 1;
+
+    case effGetProductString:
+      strncpy(static_cast<char*>(ptr), kName, kVstMaxProductStrLen - 1);
+      return 1;
+
+    case effGetVendorVersion:
+      return 1;
+
+    case effCanDo: {
+      const char* canDo = static_cast<const char*>(ptr);
+      if (canDo != nullptr && (strcmp(canDo, "receiveVstEvents") == 0 || strcmp(canDo, "receiveVstMidiEvent") == 0)) {
+        return 1;
+      }
+      return 0;
+    }
+
+    case effGetTailSize:
+      return std::max(static_cast<VstIntPtr>(settings.releaseSeconds * sampleRate), static_cast<VstIntPtr>(1));
+
+    case effGetVstVersion:
+      return 2400;
+
+    case effSetProcessPrecision:
+      // Both precisions are always available
+      return 1;
+
+    case effGetNumMidiInputChannels:
+      return 16;
+  }
+  return 0;
+}
+
+VstIntPtr VSTCALLBACK ReferenceInstrument::dispatcherProc(AEffect* effect, VstInt32 opCode, VstInt32 index,
+  VstIntPtr value, void* ptr, float opt) {
+  return static_cast<ReferenceInstrument*>(effect->object)->dispatch(opCode, index, value, ptr, opt);
+}
+
+void VSTCALLBACK ReferenceInstrument::processReplacingProc(AEffect* effect, float**, float** outputs,
+  VstInt32 numFrames) {
+  static_cast<ReferenceInstrument*>(effect->object)->process(outputs, numFrames);
+}
+
+void VSTCALLBACK ReferenceInstrument::processDoubleReplacingProc(AEffect* effect, double**, double** outputs,
+  VstInt32 numFrames) {
+  static_cast<ReferenceInstrument*>(effect->object)->process(outputs, numFrames);
+}
+
+float VSTCALLBACK ReferenceInstrument::getParameterProc(AEffect*, VstInt32) {
+  return 0.0f;
+}
+
+void VSTCALLBACK ReferenceInstrument::setParameterProc(AEffect*, VstInt32, float) {
+}
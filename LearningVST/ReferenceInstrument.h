@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "Types.h"
+#include "VstSdk.h"
+
+// A VST2 instrument built into the host, for measuring the host rather than
+// whatever third-party synth happens to be loaded. It implements the same
+// AEffect contract a plugin DLL does (dispatcher, processReplacing and
+// processDoubleReplacing, events through effProcessEvents) with a cost you
+// choose: a sine oscillator per voice, an optional synthetic CPU burn per
+// voice per sample, and optional real-time faults (heap allocation or
+// sleeping in the process call) for exercising RealtimeChecker and the
+// profiler. VstPlugin opens it directly, so it also runs where no plugin
+// binaries can be loaded.
+class ReferenceInstrument {
+public:
+  static constexpr const char* kName = "LearningVST Reference";
+  static constexpr uint kMaxEventsPerBlock = 4096; // Events beyond this in one block are ignored
+
+  enum class Fault {
+    None,
+    Allocate, // Allocate and free Settings::allocationBytes
+    Sleep,    // Sleep for Settings::sleepMicroseconds
+  };
+
+  struct Settings {
+    int numOutputs = 2;
+    uint maxVoices = 32;           // The oldest voice is stolen beyond this
+    uint burnPerVoice = 0;         // Extra dependent multiply-adds per voice per sample
+    double releaseSeconds = 0.05;
+    Fault fault = Fault::None;
+    uint faultEveryBlocks = 1;     // Fault on every Nth process call
+    size_t allocationBytes = 4096;
+    uint sleepMicroseconds = 1000;
+  };
+
+  // Parses "none", "allocate" or "sleep"
+  static bool parseFault(const std::string& name, Fault& fault);
+
+protected:
+  struct Voice {
+    int key = -1;    // -1 while free
+    bool released = false;
+    ulong age = 0;   // Note on order, for stealing
+    double phase = 0.0; // In cycles
+    double increment = 0.0;
+    double level = 0.0;
+    double target = 0.0; // Level the envelope is heading for
+    double burn = 0.0;
+  };
+
+  AEffect effect;
+  audioMasterCallback hostCallback;
+  Settings settings;
+
+  double sampleRate = 44100.0;
+  double attackStep = 0.0; // Envelope change per sample
+  double releaseStep = 0.0;
+  std::vector<Voice> voices;
+  ulong numNotesStarted = 0;
+
+  // Events for the next process call, copied out of effProcessEvents
+  std::vector<VstMidiEvent> pendingEvents;
+  size_t numPendingEvents = 0;
+  ulong numBlocks = 0;
+
+  // One cycle of a sine, plus a guard point for interpolation
+  static constexpr uint kTableSize = 2048;
+  static const std::vector<float>& getSineTable();
+
+  ReferenceInstrument(const Settings& settings, audioMasterCallback hostCallback);
+
+  void updateEnvelope();
+  void handleMidiEvent(const VstMidiEvent& midiEvent);
+  void noteOn(int key, int velocity);
+  void noteOff(int key);
+  void allNotesOff(bool immediately);
+  void injectFault();
+
+  // Mono sum of every voice, written to each output
+  template <typename T> void render(T** outputs, ulong startFrame, ulong endFrame);
+  template <typename T> void process(T** outputs, VstInt32 numFrames);
+
+  VstIntPtr dispatch(VstInt32 opCode, VstInt32 index, VstIntPtr value, void* ptr, float opt);
+
+  static VstIntPtr VSTCALLBACK dispatcherProc(AEffect* effect, VstInt32 opCode, VstInt32 index, VstIntPtr value,
+    void* ptr, float opt);
+  static void VSTCALLBACK processReplacingProc(AEffect* effect, float** inputs, float** outputs, VstInt32 numFrames);
+  static void VSTCALLBACK processDoubleReplacingProc(AEffect* effect, double** inputs, double** outputs,
+    VstInt32 numFrames);
+  static float VSTCALLBACK getParameterProc(AEffect* effect, VstInt32 index);
+  static void VSTCALLBACK setParameterProc(AEffect* effect, VstInt32 index, float value);
+
+public:
+  // A new instance, as a plugin's entry function would return it. It
+  // deletes itself on effClose.
+  static AEffect* create(const Settings& settings, audioMasterCallback hostCallback);
+};
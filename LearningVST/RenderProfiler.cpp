@@ -0,0 +1,265 @@
+#include "RenderProfiler.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include "Json.h"
+
+const char* RenderProfiler::getStageName(RenderStage stage) {
+  switch (stage) {
+    case RenderStage::MidiBlock:
+      return "midiBlock";
+    case RenderStage::MetaEvents:
+      return "metaEvents";
+    case RenderStage::MidiEvents:
+      return "midiEvents";
+    case RenderStage::ProcessAudio:
+      return "processAudio";
+    case RenderStage::Analysis:
+      return "analysis";
+    case RenderStage::WriteOutput:
+      return "writeOutput";
+    case RenderStage::FileWrite:
+      return "fileWrite";
+    default:
+      return "unknown";
+  }
+}
+
+void RenderProfiler::registerThread() {
+  if (!enabled || getThreadProfile() != nullptr) {
+    return;
+  }
+
+  auto threadProfile = std::make_unique<ThreadProfile>();
+  std::string error;
+  bool counting = countersEnabled && threadProfile->counters.open(error);
+
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  if (counting) {
+    ++numCountingThreads;
+  }
+  else if (countersEnabled && !countersFailed) {
+    std::cerr << "Hardware performance counters unavailable: " << error << "; profiling time only" << std::endl;
+    countersFailed = true;
+  }
+  getThreadProfile() = threadProfile.get();
+  threads.push_back(std::move(threadProfile));
+}
+
+void RenderProfiler::recordBlock(ulong startFrame, ulong numFrames, uint64_t nanoseconds) {
+  blocks.record(nanoseconds);
+  this->numFrames += numFrames;
+
+  // Kept sorted, slowest first; there are few enough to just shuffle along
+  if (numWorstBlocks < kNumWorstBlocks || nanoseconds > worstBlocks[numWorstBlocks - 1].nanoseconds) {
+    size_t position = std::min(numWorstBlocks, kNumWorstBlocks - 1);
+    while (position > 0 && worstBlocks[position - 1].nanoseconds < nanoseconds) {
+      worstBlocks[position] = worstBlocks[position - 1];
+      --position;
+    }
+    worstBlocks[position] = { startFrame, numFrames, nanoseconds };
+    numWorstBlocks = std::min(numWorstBlocks + 1, kNumWorstBlocks);
+  }
+}
+
+std::array<LatencyHistogram, RenderProfiler::kNumStages> RenderProfiler::mergeStages() {
+  std::array<LatencyHistogram, kNumStages> stages;
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  for (const auto& thread : threads) {
+    for (size_t stage = 0; stage < kNumStages; ++stage) {
+      stages[stage].merge(thread->stages[stage]);
+    }
+  }
+  return stages;
+}
+
+std::array<PerfCounterGroup::Values, RenderProfiler::kNumStages> RenderProfiler::mergeStageCounts() {
+  std::array<PerfCounterGroup::Values, kNumStages> stageCounts;
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  for (const auto& thread : threads) {
+    for (size_t stage = 0; stage < kNumStages; ++stage) {
+      for (size_t counter = 0; counter < PerfCounterGroup::NumCounters; ++counter) {
+        stageCounts[stage].counts[counter] += thread->stageCounts[stage].counts[counter];
+      }
+    }
+  }
+  return stageCounts;
+}
+
+static double toMicroseconds(uint64_t nanoseconds) {
+  return static_cast<double>(nanoseconds) / 1000.0;
+}
+
+static double toMilliseconds(uint64_t nanoseconds) {
+  return static_cast<double>(nanoseconds) / 1000000.0;
+}
+
+// Time spent per second of audio; under 1 is faster than real time
+static double getRealTimeFactor(uint64_t nanoseconds, double audioSeconds) {
+  return audioSeconds > 0.0 ? static_cast<double>(nanoseconds) / (audioSeconds * 1e9) : 0.0;
+}
+
+static void printHistogramRow(std::ostream& os, const char* name, const LatencyHistogram& histogram,
+  double audioSeconds) {
+  os << "  " << std::left << std::setw(14) << name << std::right <<
+    std::setw(10) << histogram.getCount() <<
+    std::setw(12) << toMilliseconds(histogram.getTotal()) <<
+    std::setw(10) << getRealTimeFactor(histogram.getTotal(), audioSeconds) <<
+    std::setw(11) << toMicroseconds(histogram.getPercentile(50.0)) <<
+    std::setw(11) << toMicroseconds(histogram.getPercentile(99.0)) <<
+    std::setw(11) << toMicroseconds(histogram.getPercentile(99.9)) <<
+    std::setw(11) << toMicroseconds(histogram.getMax()) << std::endl;
+}
+
+void RenderProfiler::printSummary(std::ostream& os, double sampleRate) {
+  auto stages = mergeStages();
+  double audioSeconds = numFrames / sampleRate;
+  double renderSeconds = static_cast<double>(blocks.getTotal()) / 1e9;
+
+  auto flags = os.flags();
+  auto precision = os.precision();
+  os << std::fixed << std::setprecision(3);
+
+  os << "Rendered " << audioSeconds << "s of audio in " << renderSeconds << "s over " <<
+    blocks.getCount() << " blocks: real-time factor " << std::setprecision(4) <<
+    getRealTimeFactor(blocks.getTotal(), audioSeconds) << std::setprecision(1) << " (" <<
+    (renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0) << "x real time)" << std::endl;
+
+  os << "  " << std::left << std::setw(14) << "stage" << std::right << std::setw(10) << "count" <<
+    std::setw(12) << "total ms" << std::setw(10) << "RTF" << std::setw(11) << "p50 us" <<
+    std::setw(11) << "p99 us" << std::setw(11) << "p99.9 us" << std::setw(11) << "max us" << std::endl;
+  os << std::setprecision(3);
+  for (size_t stage = 0; stage < kNumStages; ++stage) {
+    if (stages[stage].getCount() > 0) {
+      printHistogramRow(os, getStageName(static_cast<RenderStage>(stage)), stages[stage], audioSeconds);
+    }
+  }
+  printHistogramRow(os, "block", blocks, audioSeconds);
+
+  // Misses are per frame rendered, so plugins can be compared whatever the
+  // render length
+  if (numCountingThreads > 0) {
+    auto stageCounts = mergeStageCounts();
+    os << "Hardware counters" << (pluginName.empty() ? "" : " for " + pluginName) << ":" << std::endl;
+    os << "  " << std::left << std::setw(14) << "stage" << std::right << std::setw(14) << "cycles/call" <<
+      std::setw(8) << "IPC" << std::setw(16) << "cache miss/smp" << std::setw(16) << "branch miss/smp" << std::endl;
+    for (size_t stage = 0; stage < kNumStages; ++stage) {
+      const auto& counts = stageCounts[stage].counts;
+      uint64_t numCalls = stages[stage].getCount();
+      if (numCalls == 0) {
+        continue;
+      }
+      os << "  " << std::left << std::setw(14) << getStageName(static_cast<RenderStage>(stage)) << std::right <<
+        std::setprecision(0) << std::setw(14) << static_cast<double>(counts[PerfCounterGroup::Cycles]) / numCalls <<
+        std::setprecision(2) << std::setw(8) << (counts[PerfCounterGroup::Cycles] > 0 ?
+          static_cast<double>(counts[PerfCounterGroup::Instructions]) / counts[PerfCounterGroup::Cycles] : 0.0) <<
+        std::setprecision(4) << std::setw(16) << (numFrames > 0 ?
+          static_cast<double>(counts[PerfCounterGroup::CacheMisses]) / numFrames : 0.0) <<
+        std::setw(16) << (numFrames > 0 ?
+          static_cast<double>(counts[PerfCounterGroup::BranchMisses]) / numFrames : 0.0) << std::endl;
+    }
+    os << std::setprecision(3);
+  }
+
+  if (numWorstBlocks > 0) {
+    os << "Slowest blocks:" << std::endl;
+    for (size_t i = 0; i < numWorstBlocks; ++i) {
+      os << "  at " << worstBlocks[i].startFrame / sampleRate << "s, " << worstBlocks[i].numFrames <<
+        " frames: " << toMicroseconds(worstBlocks[i].nanoseconds) << "us" << std::endl;
+    }
+  }
+
+  os.flags(flags);
+  os.precision(precision);
+}
+
+static void writeCountersJson(std::ostream& os, const PerfCounterGroup::Values& values, ulong numFrames) {
+  const auto& counts = values.counts;
+  os << "{ ";
+  for (size_t counter = 0; counter < PerfCounterGroup::NumCounters; ++counter) {
+    os << "\"" << PerfCounterGroup::getCounterName(static_cast<PerfCounterGroup::Counter>(counter)) << "\": " <<
+      counts[counter] << ", ";
+  }
+  os << "\"ipc\": " << (counts[PerfCounterGroup::Cycles] > 0 ?
+    static_cast<double>(counts[PerfCounterGroup::Instructions]) / counts[PerfCounterGroup::Cycles] : 0.0) <<
+    ", \"cacheMissesPerSample\": " << (numFrames > 0 ?
+      static_cast<double>(counts[PerfCounterGroup::CacheMisses]) / numFrames : 0.0) <<
+    ", \"branchMissesPerSample\": " << (numFrames > 0 ?
+      static_cast<double>(counts[PerfCounterGroup::BranchMisses]) / numFrames : 0.0) << " }";
+}
+
+static void writeHistogramJson(std::ostream& os, const LatencyHistogram& histogram, double audioSeconds) {
+  os << "{ \"count\": " << histogram.getCount() <<
+    ", \"totalMs\": " << toMilliseconds(histogram.getTotal()) <<
+    ", \"realTimeFactor\": " << getRealTimeFactor(histogram.getTotal(), audioSeconds) <<
+    ", \"p50Us\": " << toMicroseconds(histogram.getPercentile(50.0)) <<
+    ", \"p99Us\": " << toMicroseconds(histogram.getPercentile(99.0)) <<
+    ", \"p999Us\": " << toMicroseconds(histogram.getPercentile(99.9)) <<
+    ", \"maxUs\": " << toMicroseconds(histogram.getMax()) << " }";
+}
+
+bool RenderProfiler::writeJson(const std::string& fileName, const std::vector<std::string>& audioFileNames,
+  double sampleRate) {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create profile file " << fileName << std::endl;
+    return false;
+  }
+
+  auto stages = mergeStages();
+  auto stageCounts = mergeStageCounts();
+  double audioSeconds = numFrames / sampleRate;
+  ofs << std::fixed << std::setprecision(6);
+
+  ofs << "{" << std::endl;
+  writeJsonAudioFiles(ofs, audioFileNames);
+  ofs << "  \"plugin\": \"" << escapeJson(pluginName) << "\"," << std::endl;
+  ofs << "  \"sampleRate\": " << static_cast<ulong>(sampleRate) << "," << std::endl;
+  ofs << "  \"numFrames\": " << numFrames << "," << std::endl;
+  ofs << "  \"audioSeconds\": " << audioSeconds << "," << std::endl;
+  ofs << "  \"renderSeconds\": " << static_cast<double>(blocks.getTotal()) / 1e9 << "," << std::endl;
+  ofs << "  \"realTimeFactor\": " << getRealTimeFactor(blocks.getTotal(), audioSeconds) << "," << std::endl;
+  ofs << "  \"numThreads\": " << threads.size() << "," << std::endl;
+  ofs << "  \"numCountingThreads\": " << numCountingThreads << "," << std::endl;
+
+  ofs << "  \"blocks\": ";
+  writeHistogramJson(ofs, blocks, audioSeconds);
+  ofs << "," << std::endl;
+
+  ofs << "  \"stages\": {" << std::endl;
+  for (size_t stage = 0; stage < kNumStages; ++stage) {
+    ofs << "    \"" << getStageName(static_cast<RenderStage>(stage)) << "\": ";
+    writeHistogramJson(ofs, stages[stage], audioSeconds);
+    ofs << (stage + 1 < kNumStages ? "," : "") << std::endl;
+  }
+  ofs << "  }," << std::endl;
+
+  // Only when there were counters to read
+  if (numCountingThreads > 0) {
+    ofs << "  \"counters\": {" << std::endl;
+    for (size_t stage = 0; stage < kNumStages; ++stage) {
+      ofs << "    \"" << getStageName(static_cast<RenderStage>(stage)) << "\": ";
+      writeCountersJson(ofs, stageCounts[stage], numFrames);
+      ofs << (stage + 1 < kNumStages ? "," : "") << std::endl;
+    }
+    ofs << "  }," << std::endl;
+  }
+
+  ofs << "  \"worstBlocks\": [" << std::endl;
+  for (size_t i = 0; i < numWorstBlocks; ++i) {
+    ofs << "    { \"startSeconds\": " << worstBlocks[i].startFrame / sampleRate <<
+      ", \"startFrame\": " << worstBlocks[i].startFrame <<
+      ", \"numFrames\": " << worstBlocks[i].numFrames <<
+      ", \"us\": " << toMicroseconds(worstBlocks[i].nanoseconds) << " }" <<
+      (i + 1 < numWorstBlocks ? "," : "") << std::endl;
+  }
+  ofs << "  ]" << std::endl;
+  ofs << "}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing profile file " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+#include "Types.h"
+#include "LatencyHistogram.h"
+#include "PerfCounters.h"
+
+// Where render time goes, stage by stage. Stages nest where the code does:
+// FileWrite is part of WriteOutput for a single file, and runs on the stem
+// threads otherwise.
+enum class RenderStage {
+  MidiBlock,    // Picking the block's events out of the sequence
+  MetaEvents,   // Tempo changes and the like
+  MidiEvents,   // Converting and sending events to the plugin
+  ProcessAudio, // The plugin's process call
+  Analysis,     // Silence detection and --analyze
+  WriteOutput,  // Handing the block to the output, on the render thread
+  FileWrite,    // Encoding and writing a WAV file, on whichever thread does it
+  NumStages
+};
+
+// Singleton; use RenderProfiler::get. Does nothing until enabled.
+//
+// Each thread records into its own histograms, so timing a stage takes no
+// locks or atomics; threads are only merged for the report, once they've
+// finished. Threads should call registerThread before their first timed
+// block, which is the only time the profiler allocates.
+//
+// With counters enabled, each thread also gets a group of hardware counters,
+// read around every stage. They degrade to timing only wherever the system
+// won't give us counters.
+class RenderProfiler {
+public:
+  static constexpr size_t kNumStages = static_cast<size_t>(RenderStage::NumStages);
+  static constexpr size_t kNumWorstBlocks = 10;
+
+  struct Block {
+    ulong startFrame = 0;
+    ulong numFrames = 0;
+    uint64_t nanoseconds = 0;
+  };
+
+protected:
+  struct ThreadProfile {
+    std::array<LatencyHistogram, kNumStages> stages;
+    PerfCounterGroup counters;
+    std::array<PerfCounterGroup::Values, kNumStages> stageCounts;
+  };
+
+  bool enabled = false;
+  bool countersEnabled = false;
+  bool countersFailed = false;  // Guarded by threadsMutex; so we only complain once
+  uint numCountingThreads = 0;  // Guarded by threadsMutex
+  std::string pluginName;
+  std::mutex threadsMutex; // Guards threads, which only change on registration
+  std::vector<std::unique_ptr<ThreadProfile>> threads;
+
+  // Blocks are timed on the render thread only
+  LatencyHistogram blocks;
+  ulong numFrames = 0;
+  std::array<Block, kNumWorstBlocks> worstBlocks = { };
+  size_t numWorstBlocks = 0;
+
+  static ThreadProfile*& getThreadProfile() {
+    thread_local ThreadProfile* threadProfile = nullptr;
+    return threadProfile;
+  }
+
+  RenderProfiler() {
+  }
+
+  // Each stage merged over every thread
+  std::array<LatencyHistogram, kNumStages> mergeStages();
+  std::array<PerfCounterGroup::Values, kNumStages> mergeStageCounts();
+
+public:
+  static RenderProfiler& get() {
+    static RenderProfiler renderProfiler;
+    return renderProfiler;
+  }
+
+  static const char* getStageName(RenderStage stage);
+
+  inline void setEnabled(bool enabled) {
+    this->enabled = enabled;
+  }
+
+  inline bool isEnabled() const {
+    return enabled;
+  }
+
+  // Hardware counters too (see PerfCounterGroup); set before any thread registers
+  inline void setCountersEnabled(bool countersEnabled) {
+    this->countersEnabled = countersEnabled;
+  }
+
+  inline bool areCountersEnabled() const {
+    return countersEnabled;
+  }
+
+  // For the report
+  inline void setPluginName(const std::string& pluginName) {
+    this->pluginName = pluginName;
+  }
+
+  // Monotonic, in nanoseconds from an arbitrary start
+  static inline uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  // Sets up the calling thread's histograms, if enabled; safe to call more
+  // than once
+  void registerThread();
+
+  inline void record(RenderStage stage, uint64_t nanoseconds) {
+    ThreadProfile* threadProfile = getThreadProfile();
+    if (threadProfile == nullptr) {
+      registerThread();
+      threadProfile = getThreadProfile();
+    }
+    threadProfile->stages[static_cast<size_t>(stage)].record(nanoseconds);
+  }
+
+  // The calling thread's counters so far; false if it has none
+  inline bool readCounters(PerfCounterGroup::Values& values) {
+    ThreadProfile* threadProfile = getThreadProfile();
+    return threadProfile != nullptr && threadProfile->counters.read(values);
+  }
+
+  inline void recordCounters(RenderStage stage, const PerfCounterGroup::Values& start,
+    const PerfCounterGroup::Values& end) {
+    auto& counts = getThreadProfile()->stageCounts[static_cast<size_t>(stage)].counts;
+    for (size_t counter = 0; counter < counts.size(); ++counter) {
+      counts[counter] += end.counts[counter] - start.counts[counter];
+    }
+  }
+
+  // A whole block of the render loop, from the render thread
+  void recordBlock(ulong startFrame, ulong numFrames, uint64_t nanoseconds);
+
+  // Call once every thread that recorded has finished
+  void printSummary(std::ostream& os, double sampleRate);
+  bool writeJson(const std::string& fileName, const std::vector<std::string>& audioFileNames, double sampleRate);
+};
+
+// Times the enclosing scope as a stage, if the profiler's enabled, and counts
+// it if counters are too
+class ProfileScope {
+protected:
+  RenderStage stage;
+  uint64_t start = 0;
+  bool counting = false;
+  PerfCounterGroup::Values startCounts;
+
+public:
+  inline ProfileScope(RenderStage stage) {
+    this->stage = stage;
+    RenderProfiler& profiler = RenderProfiler::get();
+    if (profiler.isEnabled()) {
+      counting = profiler.areCountersEnabled() && profiler.readCounters(startCounts);
+      start = RenderProfiler::now();
+    }
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  inline ~ProfileScope() {
+    if (start != 0) {
+      RenderProfiler& profiler = RenderProfiler::get();
+      profiler.record(stage, RenderProfiler::now() - start);
+
+      PerfCounterGroup::Values endCounts;
+      if (counting && profiler.readCounters(endCounts)) {
+        profiler.recordCounters(stage, startCounts, endCounts);
+      }
+    }
+  }
+};
@@ -1,46 +1,91 @@
 #pragma once
 
 #include "Types.h"
+#include "ChannelCount.h"
+#include <array>
 #include <vector>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// How channel data is laid out in memory
+enum class SampleBufferLayout {
+  Packed,  // Channels back to back; start addresses only as aligned as T
+  Aligned, // Each channel starts on a cache line and is padded to a whole number of them
+};
+
+// kChannels fixes the channel count at compile time (see ChannelCount.h); the
+// channel pointers then live inline rather than in a vector
+template <typename T, ushort kChannels = kDynamicChannels> class SampleBuffer {
+public:
+  // A cache line, which also covers the widest SIMD loads (AVX-512)
+  static constexpr size_t kAlignment = 64;
 
-template <typename T> class SampleBuffer {
 protected:
+  typedef typename std::conditional<kChannels == kDynamicChannels,
+    std::vector<T*>, std::array<T*, kChannels>>::type ChannelPointers;
+
   ushort numChannels;
   ulong blockSize;
+  ulong channelStride; // Distance in samples from the start of one channel to the next
+  SampleBufferLayout layout;
+  ChannelPointers channels;
   std::vector<uchar> data;
+
 public:
-  SampleBuffer(ushort numChannels, ulong blockSize) {
+  SampleBuffer(ushort numChannels, ulong blockSize, SampleBufferLayout layout = SampleBufferLayout::Aligned) {
+    assert(kChannels == kDynamicChannels || numChannels == kChannels);
     this->numChannels = numChannels;
     this->blockSize = blockSize;
+    this->layout = layout;
 
-    // One T* and blockSize T for each channel
-    data.resize((sizeof(T*) + (sizeof(T) * blockSize)) * numChannels);
+    // Aligned channels are padded so the next one also starts on a cache line
+    // and no two channels share one
+    const ulong samplesPerLine = static_cast<ulong>(kAlignment / sizeof(T));
+    if (layout == SampleBufferLayout::Aligned) {
+      channelStride = ((blockSize + samplesPerLine - 1) / samplesPerLine) * samplesPerLine;
+    }
+    else {
+      channelStride = blockSize;
+    }
+
+    // Over-allocate so the first channel can be moved up to an aligned address
+    const size_t alignment = getAlignment();
+    data.resize(sizeof(T) * channelStride * numChannels + alignment - 1);
+    auto base = reinterpret_cast<uintptr_t>(data.data());
+    auto first = reinterpret_cast<T*>((base + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
 
     // Fixup pointers and zero
-    auto p = reinterpret_cast<T**>(data.data());
-    auto s = reinterpret_cast<T* >(data.data() + sizeof(T*) * numChannels);
+    if constexpr (kChannels == kDynamicChannels) {
+      channels.resize(numChannels);
+    }
     for (auto i = 0; i < numChannels; ++i) {
-      p[i] = s + (i * blockSize);
-      memset(p[i], 0, sizeof(T) * blockSize);
+      channels[i] = first + (i * channelStride);
+      memset(channels[i], 0, sizeof(T) * channelStride);
     }
   }
 
+  // Channel pointers point into our own storage, so copies would alias it
+  SampleBuffer(const SampleBuffer&) = delete;
+  SampleBuffer& operator=(const SampleBuffer&) = delete;
+  SampleBuffer(SampleBuffer&&) = default;
+  SampleBuffer& operator=(SampleBuffer&&) = default;
+
   ~SampleBuffer() {
   }
 
   void zero() {
-    auto p = reinterpret_cast<T**>(data.data());
-    for (auto i = 0; i < numChannels; ++i) {
-      memset(p[i], 0, sizeof(T) * blockSize);
+    for (ushort i = 0; i < getNumChannels(); ++i) {
+      memset(channels[i], 0, sizeof(T) * blockSize);
     }
   }
 
   inline T** getSamples() const {
-    return reinterpret_cast<T**>(const_cast<uchar*>(data.data()));
+    return const_cast<T**>(channels.data());
   }
 
   inline T** getSamples() {
-    return reinterpret_cast<T**>(data.data());
+    return channels.data();
   }
 
   inline ulong getBlockSize() const {
@@ -48,7 +93,25 @@ public:
   }
 
   inline ushort getNumChannels() const {
-    return numChannels;
+    return resolveChannelCount<kChannels>(numChannels);
+  }
+
+  inline ulong getChannelStride() const {
+    return channelStride;
+  }
+
+  inline SampleBufferLayout getLayout() const {
+    return layout;
+  }
+
+  // Every channel pointer is a multiple of this many bytes, and for aligned
+  // buffers so is the stride between channels
+  inline size_t getAlignment() const {
+    return layout == SampleBufferLayout::Aligned ? kAlignment : alignof(T);
+  }
+
+  inline bool isAligned() const {
+    return layout == SampleBufferLayout::Aligned;
   }
 };
 
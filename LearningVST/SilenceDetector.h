@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Types.h"
+#include "SampleBuffer.h"
+#include "AudioKernels.h"
+
+// Tracks how long the output has stayed below a threshold. Once it has been
+// quiet for the whole window (e.g. the plugin's reported tail) we consider
+// the plugin to have nothing more to say until it receives new events.
+class SilenceDetector {
+protected:
+  float threshold;
+  ulong windowFrames;
+  ulong silentFrames = 0;
+
+public:
+  SilenceDetector(float thresholdDb, ulong windowFrames) {
+    this->threshold = AudioKernels::dbToGain(thresholdDb);
+    this->windowFrames = windowFrames;
+  }
+
+  void reset() {
+    silentFrames = 0;
+  }
+
+  // Returns true if the first numFrames of every channel are below threshold
+  template <typename T, ushort kChannels> bool process(const SampleBuffer<T, kChannels>& sampleBuffer, ulong numFrames) {
+    for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
+      if (AudioKernels::peakAbs(sampleBuffer.getSamples()[c], numFrames) >= threshold) {
+        silentFrames = 0;
+        return false;
+      }
+    }
+    silentFrames += numFrames;
+    return true;
+  }
+
+  inline bool isSilent() const {
+    return silentFrames >= windowFrames;
+  }
+};
@@ -0,0 +1,267 @@
+#include "SmfWriter.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <math.h>
+#include <assert.h>
+
+void SmfWriter::writeVariableLength(std::vector<uchar>& data, ulong value) {
+  // 7 bits per byte, most significant first, high bit set on all but the last
+  uchar bytes[5];
+  int numBytes = 0;
+  do {
+    bytes[numBytes++] = static_cast<uchar>(value & 0x7F);
+    value >>= 7;
+  } while (value > 0);
+
+  for (int i = numBytes - 1; i >= 0; --i) {
+    data.push_back(bytes[i] | (i > 0 ? 0x80 : 0x00));
+  }
+}
+
+void SmfWriter::writeBigEndian(std::vector<uchar>& data, ulong value, int numBytes) {
+  for (int i = numBytes - 1; i >= 0; --i) {
+    data.push_back(static_cast<uchar>((value >> (i * 8)) & 0xFF));
+  }
+}
+
+size_t SmfWriter::getEventCount() const {
+  size_t numEvents = 0;
+  for (const auto& track : tracks) {
+    numEvents += track.events.size();
+  }
+  return numEvents;
+}
+
+size_t SmfWriter::addTrack() {
+  tracks.emplace_back();
+  return tracks.size() - 1;
+}
+
+void SmfWriter::addEvent(size_t track, ulong tick, std::initializer_list<uchar> bytes, const uchar* data,
+  size_t dataSize) {
+  assert(track < tracks.size());
+  Track& currentTrack = tracks[track];
+  Event event;
+  event.tick = tick;
+  event.offset = static_cast<uint>(currentTrack.pool.size());
+  currentTrack.pool.insert(currentTrack.pool.end(), bytes);
+  if (dataSize > 0) {
+    currentTrack.pool.insert(currentTrack.pool.end(), data, data + dataSize);
+  }
+  event.size = static_cast<uint>(currentTrack.pool.size() - event.offset);
+  currentTrack.events.push_back(event);
+}
+
+void SmfWriter::addMeta(size_t track, ulong tick, MidiEvent::MetaType type, const uchar* data, size_t dataSize) {
+  uchar metaByte;
+  switch (type) {
+    case MidiEvent::MetaType::SequenceNumber:
+      metaByte = 0x00;
+      break;
+    case MidiEvent::MetaType::TextEvent:
+      metaByte = 0x01;
+      break;
+    case MidiEvent::MetaType::CopyrightNotice:
+      metaByte = 0x02;
+      break;
+    case MidiEvent::MetaType::SequenceOrTrackName:
+      metaByte = 0x03;
+      break;
+    case MidiEvent::MetaType::InstrumentName:
+      metaByte = 0x04;
+      break;
+    case MidiEvent::MetaType::Lyric:
+      metaByte = 0x05;
+      break;
+    case MidiEvent::MetaType::Marker:
+      metaByte = 0x06;
+      break;
+    case MidiEvent::MetaType::CuePoint:
+      metaByte = 0x07;
+      break;
+    case MidiEvent::MetaType::MidiChannelPrefix:
+      metaByte = 0x20;
+      break;
+    case MidiEvent::MetaType::SetTempo:
+      metaByte = 0x51;
+      break;
+    case MidiEvent::MetaType::SmtpeOffset:
+      metaByte = 0x54;
+      break;
+    case MidiEvent::MetaType::TimeSignature:
+      metaByte = 0x58;
+      break;
+    case MidiEvent::MetaType::KeySignature:
+      metaByte = 0x59;
+      break;
+    case MidiEvent::MetaType::SequencerSpecificMetaEvent:
+      metaByte = 0x7F;
+      break;
+    default:
+      assert(!"End of track is added by build");
+      return;
+  }
+
+  // MidiSource reads the length as a single byte, so keep to what fits in one
+  // byte of a variable length quantity
+  assert(dataSize < 0x80);
+  addEvent(track, tick, { 0xFF, metaByte, static_cast<uchar>(dataSize) }, data, dataSize);
+}
+
+void SmfWriter::addText(size_t track, ulong tick, MidiEvent::MetaType type, const std::string& text) {
+  addMeta(track, tick, type, reinterpret_cast<const uchar*>(text.data()), std::min<size_t>(text.size(), 0x7F));
+}
+
+void SmfWriter::addTempo(size_t track, ulong tick, double beatsPerMinute) {
+  assert(beatsPerMinute > 0.0);
+  ulong beatLengthInUs = std::min(static_cast<ulong>(lround(60000000.0 / beatsPerMinute)), 0xFFFFFFul);
+  uchar data[3] = {
+    static_cast<uchar>(beatLengthInUs >> 16),
+    static_cast<uchar>(beatLengthInUs >> 8),
+    static_cast<uchar>(beatLengthInUs),
+  };
+  addMeta(track, tick, MidiEvent::MetaType::SetTempo, data, sizeof(data));
+}
+
+void SmfWriter::addTimeSignature(size_t track, ulong tick, uchar numerator, uchar denominator) {
+  assert(denominator > 0);
+
+  // The denominator is stored as a power of two
+  uchar denominatorPower = 0;
+  while ((1u << (denominatorPower + 1)) <= denominator) {
+    ++denominatorPower;
+  }
+
+  // 24 MIDI clocks per metronome click, 8 32nd notes per quarter note
+  uchar data[4] = { numerator, denominatorPower, 24, 8 };
+  addMeta(track, tick, MidiEvent::MetaType::TimeSignature, data, sizeof(data));
+}
+
+void SmfWriter::addMessage(size_t track, ulong tick, MidiEvent::MessageType type, uchar channel, uchar data1,
+  uchar data2) {
+  channel &= 0x0F;
+  switch (type) {
+    case MidiEvent::MessageType::VoiceNoteOff:
+      addMessage(track, tick, 0x80 | channel, data1, data2);
+      break;
+    case MidiEvent::MessageType::VoiceNoteOn:
+      addMessage(track, tick, 0x90 | channel, data1, data2);
+      break;
+    case MidiEvent::MessageType::VoicePolyphonicKeyPressure:
+      addMessage(track, tick, 0xA0 | channel, data1, data2);
+      break;
+    case MidiEvent::MessageType::VoiceControllerChange:
+      addMessage(track, tick, 0xB0 | channel, data1, data2);
+      break;
+    case MidiEvent::MessageType::VoiceProgramChange:
+      addMessage(track, tick, 0xC0 | channel, data1);
+      break;
+    case MidiEvent::MessageType::VoiceKeyPressure:
+      addMessage(track, tick, 0xD0 | channel, data1);
+      break;
+    case MidiEvent::MessageType::VoicePitchBend:
+      addMessage(track, tick, 0xE0 | channel, data1, data2);
+      break;
+
+    // Channel mode messages are controllers 120 to 127
+    case MidiEvent::MessageType::ModeAllSoundOff:
+      addMessage(track, tick, 0xB0 | channel, 0x78, 0);
+      break;
+    case MidiEvent::MessageType::ModeResetAllControllers:
+      addMessage(track, tick, 0xB0 | channel, 0x79, 0);
+      break;
+    case MidiEvent::MessageType::ModeLocalControl:
+      addMessage(track, tick, 0xB0 | channel, 0x7A, data2);
+      break;
+    case MidiEvent::MessageType::ModeAllNotesOff:
+      addMessage(track, tick, 0xB0 | channel, 0x7B, 0);
+      break;
+    case MidiEvent::MessageType::ModeOmniModeOff:
+      addMessage(track, tick, 0xB0 | channel, 0x7C, 0);
+      break;
+    case MidiEvent::MessageType::ModeOmniModeOn:
+      addMessage(track, tick, 0xB0 | channel, 0x7D, 0);
+      break;
+    case MidiEvent::MessageType::ModeMonoModeOn:
+      addMessage(track, tick, 0xB0 | channel, 0x7E, data2);
+      break;
+    case MidiEvent::MessageType::ModePolyModeOn:
+      addMessage(track, tick, 0xB0 | channel, 0x7F, 0);
+      break;
+    default:
+      assert(!"Unknown message type");
+      break;
+  }
+}
+
+void SmfWriter::addMessage(size_t track, ulong tick, uchar status, uchar data1, uchar data2) {
+  assert((status & 0x80) && status < 0xF0);
+  uchar type = status & 0xF0;
+  if (type == 0xC0 || type == 0xD0) {
+    addEvent(track, tick, { status, static_cast<uchar>(data1 & 0x7F) });
+  }
+  else {
+    addEvent(track, tick, { status, static_cast<uchar>(data1 & 0x7F), static_cast<uchar>(data2 & 0x7F) });
+  }
+}
+
+void SmfWriter::addNote(size_t track, ulong tick, ulong durationTicks, uchar channel, uchar key, uchar velocity) {
+  addMessage(track, tick, MidiEvent::MessageType::VoiceNoteOn, channel, key, std::max<uchar>(velocity, 1));
+  addMessage(track, tick + durationTicks, MidiEvent::MessageType::VoiceNoteOff, channel, key, 0);
+}
+
+std::vector<uchar> SmfWriter::build(ushort format) const {
+  assert(format != 0 || tracks.size() == 1);
+
+  std::vector<uchar> data;
+  data.insert(data.end(), { 'M', 'T', 'h', 'd' });
+  writeBigEndian(data, 6, 4);
+  writeBigEndian(data, format, 2);
+  writeBigEndian(data, static_cast<ulong>(tracks.size()), 2);
+  writeBigEndian(data, timeDivision, 2);
+
+  std::vector<Event> sorted;
+  for (const auto& track : tracks) {
+    sorted = track.events;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Event& a, const Event& b) {
+      return a.tick < b.tick;
+    });
+
+    data.insert(data.end(), { 'M', 'T', 'r', 'k' });
+    size_t sizeOffset = data.size();
+    writeBigEndian(data, 0, 4); // Filled in below
+
+    ulong lastTick = 0;
+    for (const Event& event : sorted) {
+      writeVariableLength(data, event.tick - lastTick);
+      data.insert(data.end(), track.pool.begin() + event.offset, track.pool.begin() + event.offset + event.size);
+      lastTick = event.tick;
+    }
+    writeVariableLength(data, 0);
+    data.insert(data.end(), { 0xFF, 0x2F, 0x00 });
+
+    ulong trackBytes = static_cast<ulong>(data.size() - sizeOffset - 4);
+    for (int i = 0; i < 4; ++i) {
+      data[sizeOffset + i] = static_cast<uchar>((trackBytes >> ((3 - i) * 8)) & 0xFF);
+    }
+  }
+
+  return data;
+}
+
+bool SmfWriter::write(const std::string& fileName, ushort format) const {
+  std::vector<uchar> data = build(format);
+
+  std::ofstream ofs(fileName, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create MIDI file " << fileName << std::endl;
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+  if (!ofs.good()) {
+    std::cerr << "Error while writing MIDI file " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
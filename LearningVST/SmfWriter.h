@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <stdint.h>
+#include "Types.h"
+#include "MidiSource.h"
+
+// Builds a Standard MIDI File in memory, for test and benchmark inputs. Events
+// can be added to a track in any order; they're sorted by tick (stably, so
+// same-tick events keep the order they were added in) when the file is built.
+// Every message is written with its status byte, since MidiSource doesn't
+// read running status.
+class SmfWriter {
+public:
+  static constexpr ushort kDefaultTimeDivision = 96; // Ticks per quarter note
+
+protected:
+  // Event bytes (everything after the delta time) live in the track's pool,
+  // so long files don't cost an allocation per event
+  struct Event {
+    ulong tick;
+    uint offset;
+    uint size;
+  };
+
+  struct Track {
+    std::vector<Event> events;
+    std::vector<uchar> pool;
+  };
+
+  ushort timeDivision;
+  std::vector<Track> tracks;
+
+  void addEvent(size_t track, ulong tick, std::initializer_list<uchar> bytes, const uchar* data = nullptr,
+    size_t dataSize = 0);
+
+  static void writeVariableLength(std::vector<uchar>& data, ulong value);
+  static void writeBigEndian(std::vector<uchar>& data, ulong value, int numBytes);
+
+public:
+  SmfWriter(ushort timeDivision = kDefaultTimeDivision) {
+    this->timeDivision = timeDivision;
+  }
+
+  inline ushort getTimeDivision() const {
+    return timeDivision;
+  }
+
+  inline size_t getTrackCount() const {
+    return tracks.size();
+  }
+
+  // Not counting the end of track events build adds
+  size_t getEventCount() const;
+
+  // Returns the new track's index
+  size_t addTrack();
+
+  // Any meta event but EndOfTrack, which build adds; data can be empty
+  void addMeta(size_t track, ulong tick, MidiEvent::MetaType type, const uchar* data = nullptr, size_t dataSize = 0);
+  void addText(size_t track, ulong tick, MidiEvent::MetaType type, const std::string& text);
+  void addTempo(size_t track, ulong tick, double beatsPerMinute);
+  void addTimeSignature(size_t track, ulong tick, uchar numerator, uchar denominator);
+
+  // A channel message of the given type. For controllers data1 is the
+  // controller and data2 the value; for pitch bend data1 and data2 are the
+  // low and high 7 bits; mode messages take their value in data2.
+  void addMessage(size_t track, ulong tick, MidiEvent::MessageType type, uchar channel, uchar data1, uchar data2 = 0);
+
+  // Raw status byte; data2 is left out for program change and channel pressure
+  void addMessage(size_t track, ulong tick, uchar status, uchar data1, uchar data2 = 0);
+
+  // Note on at tick and the matching note off durationTicks later
+  void addNote(size_t track, ulong tick, ulong durationTicks, uchar channel, uchar key, uchar velocity);
+
+  // Format 0 needs exactly one track. Every track ends with an end of track
+  // event, after its last event.
+  std::vector<uchar> build(ushort format) const;
+  bool write(const std::string& fileName, ushort format) const;
+};
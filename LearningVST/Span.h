@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <assert.h>
+
+// Non-owning view of a contiguous run of elements; lets us hand slices of
+// preallocated storage around without copying them into containers
+template <typename T> class Span {
+protected:
+  T* first = nullptr;
+  size_t count = 0;
+public:
+  Span() {
+  }
+
+  Span(T* first, size_t count) {
+    this->first = first;
+    this->count = count;
+  }
+
+  inline T* begin() const {
+    return first;
+  }
+
+  inline T* end() const {
+    return first + count;
+  }
+
+  inline T* data() const {
+    return first;
+  }
+
+  inline size_t size() const {
+    return count;
+  }
+
+  inline bool empty() const {
+    return count == 0;
+  }
+
+  inline T& operator[](size_t index) const {
+    assert(index < count);
+    return first[index];
+  }
+
+  // Elements [offset, offset + length)
+  inline Span subspan(size_t offset, size_t length) const {
+    assert(offset + length <= count);
+    return Span(first + offset, length);
+  }
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include "Types.h"
+#include "ChannelCount.h"
+#include "SampleBuffer.h"
+#include "PcmWavFile.h"
+#include "GlobalSettings.h"
+#include "RenderProfiler.h"
+#include "TraceRecorder.h"
+#include "WaveformPeaks.h"
+
+// Splits the plugin's outputs into groups of channels ("stems", e.g. the kick,
+// snare and overhead pairs of a drum instrument) and writes each to its own
+// WAV file. Every stem has its own worker thread doing the encoding and I/O;
+// the render thread only copies each group's channels into a free block of
+// that stem's queue, so a slow disk or a wide bus doesn't hold up rendering.
+// Takes the same writeBuffer/writeSilence calls as PcmWavFile.
+//
+// Each queue is a single-producer, single-consumer ring handed over through
+// two atomic counters, as with VstEventRing. Only the worker sleeps: once its
+// queue is empty it waits on a condition variable for a batch of blocks, so
+// the render thread only takes the stem's lock (to signal without the signal
+// getting lost) once per batch, and never otherwise. If the render thread
+// gets a whole ring ahead it yields until the worker frees a block.
+template <typename T> class StemWriter {
+public:
+  // Blocks queued per stem before the render thread has to wait for its
+  // worker; a power of two so the counters can wrap
+  static constexpr size_t kBlocksInFlight = 16;
+
+  // Blocks queued before a sleeping worker is woken
+  static constexpr size_t kBlocksPerWake = kBlocksInFlight / 2;
+
+protected:
+  struct Block {
+    SampleBuffer<T> samples;
+    ulong numFrames = 0;
+    bool isSilence = false;
+
+    Block(ushort numChannels, ulong blockSize) : samples(numChannels, blockSize) {
+    }
+  };
+
+  struct Stem {
+    PcmWavFile pcmWavFile;
+    size_t index = 0;
+    ushort firstChannel = 0;
+    ushort numChannels = 0;
+    std::vector<Block> blocks;             // Ring; the render thread fills, the worker writes
+    std::atomic<uint64_t> numFilled { 0 };  // Blocks queued so far; render thread stores
+    std::atomic<uint64_t> numWritten { 0 }; // Blocks written so far; worker stores
+    std::atomic<bool> closing { false };    // No more blocks are coming
+    std::atomic<bool> waiting { false };    // Worker is (about to be) asleep
+    bool started = false;                   // Guarded by mutex
+    bool succeeded = true;                  // Worker only until joined
+    std::mutex mutex;                       // Only for the worker's sleeps, wakes and startup
+    std::condition_variable condition;
+    std::thread worker;
+  };
+
+  std::vector<std::unique_ptr<Stem>> stems;
+  double hashSegmentSeconds = 0.0;
+  bool writePeaks = false;
+
+  // Worker loop with the stem's channel count fixed at compile time
+  template <ushort kChannels> static void writeStem(Stem& stem) {
+    // Registration allocates, so it's done before openWrite returns
+    RenderProfiler::get().registerThread();
+    TraceRecorder::get().registerThread("stem " + std::to_string(stem.index + 1));
+    {
+      std::lock_guard<std::mutex> lock(stem.mutex);
+      stem.started = true;
+      stem.condition.notify_one();
+    }
+
+    uint64_t numWritten = 0;
+    for (;;) {
+      // closing is stored after the last block, so once it's seen numFilled is final
+      bool closing = stem.closing.load(std::memory_order_acquire);
+      if (stem.numFilled.load(std::memory_order_acquire) == numWritten) {
+        if (closing) {
+          return;
+        }
+
+        // Either this sees the render thread's latest block, or the render
+        // thread sees waiting and signals under the lock
+        std::unique_lock<std::mutex> lock(stem.mutex);
+        stem.waiting.store(true, std::memory_order_seq_cst);
+        stem.condition.wait(lock, [&stem, numWritten]() {
+          return stem.numFilled.load(std::memory_order_seq_cst) - numWritten >= kBlocksPerWake ||
+            stem.closing.load(std::memory_order_acquire);
+        });
+        stem.waiting.store(false, std::memory_order_relaxed);
+        continue;
+      }
+
+      // The render thread won't touch this block until numWritten moves past it
+      Block& block = stem.blocks[numWritten % stem.blocks.size()];
+      bool written = block.isSilence ? stem.pcmWavFile.writeSilence(block.numFrames) :
+        stem.pcmWavFile.template writeChannels<kChannels>(block.samples.getSamples(), block.numFrames);
+      stem.succeeded = stem.succeeded && written;
+      stem.numWritten.store(++numWritten, std::memory_order_release);
+    }
+  }
+
+  // The stem's next free block; yields while the worker is a whole ring behind
+  Block& acquireBlock(Stem& stem) {
+    uint64_t numFilled = stem.numFilled.load(std::memory_order_relaxed);
+    while (numFilled - stem.numWritten.load(std::memory_order_acquire) >= stem.blocks.size()) {
+      std::this_thread::yield();
+    }
+    return stem.blocks[numFilled % stem.blocks.size()];
+  }
+
+  void queueBlock(Stem& stem) {
+    uint64_t numFilled = stem.numFilled.fetch_add(1, std::memory_order_seq_cst) + 1;
+    if (stem.waiting.load(std::memory_order_seq_cst) &&
+      numFilled - stem.numWritten.load(std::memory_order_acquire) >= kBlocksPerWake) {
+      wakeWorker(stem);
+    }
+  }
+
+  // Taking the lock means the worker is either inside its wait or yet to
+  // check its predicate, so the signal can't fall in between
+  static void wakeWorker(Stem& stem) {
+    {
+      std::lock_guard<std::mutex> lock(stem.mutex);
+    }
+    stem.condition.notify_one();
+  }
+
+  // A stem's WAV file and its sidecars
+  static void removeStemFiles(const std::string& stemFileName) {
+    std::error_code error;
+    std::filesystem::remove(stemFileName, error);
+    std::filesystem::remove(WaveformPeaks::getFileName(stemFileName), error);
+    std::filesystem::remove(PcmWavFile::getContentHashFileName(stemFileName), error);
+  }
+
+  // Closes the stems opened so far and deletes their files
+  void removeStems(const std::string& fileName) {
+    for (auto& stem : stems) {
+      stem->pcmWavFile.closeWrite();
+      removeStemFiles(getStemFileName(fileName, stem->index));
+    }
+    if (!stems.empty()) {
+      std::cerr << "Removed the " << stems.size() << " stems already created" << std::endl;
+    }
+    stems.clear();
+  }
+
+public:
+  ~StemWriter() {
+    closeWrite();
+  }
+
+  // fileName with a 1-based stem number before the extension, e.g. kit.wav -> kit_3.wav
+  static std::string getStemFileName(const std::string& fileName, size_t stemIndex) {
+    std::filesystem::path path(fileName);
+    path.replace_filename(path.stem().string() + "_" + std::to_string(stemIndex + 1) + path.extension().string());
+    return path.string();
+  }
+
+  // Each stem's file name in channel order, between openWrite and closeWrite
+  std::vector<std::string> getStemFileNames(const std::string& fileName) const {
+    std::vector<std::string> stemFileNames;
+    for (const auto& stem : stems) {
+      stemFileNames.push_back(getStemFileName(fileName, stem->index));
+    }
+    return stemFileNames;
+  }
+
+  // Call before openWrite: every stem gets its own content hash (see
+  // PcmWavFile::setContentHash)
+  void setContentHash(double segmentSeconds) {
+    hashSegmentSeconds = segmentSeconds;
+  }
+
+  // Call before openWrite: every stem gets its own peak file (see
+  // PcmWavFile::setWaveformPeaks)
+  void setWaveformPeaks() {
+    writePeaks = true;
+  }
+
+  // One stem per channelsPerStem channels; the last one takes whatever is left over
+  bool openWrite(const std::string& fileName, ushort numChannels, ushort channelsPerStem,
+    uint sampleRate, AudioBitDepth bitDepth) {
+    assert(stems.empty());
+    if (channelsPerStem == 0) {
+      std::cerr << "Stems need at least one channel" << std::endl;
+      return false;
+    }
+
+    // Every file first, so a failure leaves no threads running
+    for (ushort firstChannel = 0; firstChannel < numChannels; firstChannel += channelsPerStem) {
+      auto stem = std::make_unique<Stem>();
+      stem->index = stems.size();
+      stem->firstChannel = firstChannel;
+      stem->numChannels = std::min(channelsPerStem, static_cast<ushort>(numChannels - firstChannel));
+
+      auto stemFileName = getStemFileName(fileName, stems.size());
+      if (hashSegmentSeconds > 0.0) {
+        stem->pcmWavFile.setContentHash(hashSegmentSeconds);
+      }
+      if (writePeaks) {
+        stem->pcmWavFile.setWaveformPeaks();
+      }
+      if (!stem->pcmWavFile.openWrite(stemFileName, stem->numChannels, sampleRate, bitDepth)) {
+        // It may have got as far as creating some of its files
+        stem.reset();
+        removeStemFiles(stemFileName);
+        removeStems(fileName);
+        return false;
+      }
+
+      for (size_t i = 0; i < kBlocksInFlight; ++i) {
+        stem->blocks.emplace_back(stem->numChannels, GlobalSettings::get().getBlockSize());
+      }
+      stems.push_back(std::move(stem));
+    }
+
+    for (auto& stem : stems) {
+      Stem* stemPointer = stem.get();
+      dispatchChannelCount(stem->numChannels, [stemPointer](auto channelCount) {
+        stemPointer->worker = std::thread(&StemWriter::writeStem<decltype(channelCount)::value>,
+          std::ref(*stemPointer));
+      });
+    }
+
+    for (auto& stem : stems) {
+      std::unique_lock<std::mutex> lock(stem->mutex);
+      stem->condition.wait(lock, [&stem]() { return stem->started; });
+    }
+
+    std::cout << "Writing " << stems.size() << " stems of up to " << channelsPerStem <<
+      " channels to " << getStemFileName(fileName, 0) << " onwards" << std::endl;
+    return true;
+  }
+
+  template <ushort kChannels> bool writeBuffer(const SampleBuffer<T, kChannels>& sampleBuffer, ulong numFrames) {
+    assert(numFrames <= sampleBuffer.getBlockSize());
+
+    for (auto& stem : stems) {
+      Block& block = acquireBlock(*stem);
+      for (ushort c = 0; c < stem->numChannels; ++c) {
+        memcpy(block.samples.getSamples()[c],
+          sampleBuffer.getSamples()[stem->firstChannel + c], sizeof(T) * numFrames);
+      }
+      block.numFrames = numFrames;
+      block.isSilence = false;
+      queueBlock(*stem);
+    }
+    return true;
+  }
+
+  bool writeSilence(ulong numFrames) {
+    for (auto& stem : stems) {
+      Block& block = acquireBlock(*stem);
+      block.numFrames = numFrames;
+      block.isSilence = true;
+      queueBlock(*stem);
+    }
+    return true;
+  }
+
+  // Drains every queue, then finishes each file
+  bool closeWrite() {
+    bool succeeded = true;
+    for (auto& stem : stems) {
+      stem->closing.store(true, std::memory_order_release);
+      wakeWorker(*stem);
+      if (stem->worker.joinable()) {
+        stem->worker.join();
+      }
+      succeeded = stem->pcmWavFile.closeWrite() && stem->succeeded && succeeded;
+    }
+    stems.clear();
+    return succeeded;
+  }
+};
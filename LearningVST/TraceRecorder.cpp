@@ -0,0 +1,90 @@
+#include "TraceRecorder.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include "Json.h"
+
+void TraceRecorder::enable(size_t zonesPerThread) {
+  this->zonesPerThread = 1;
+  while (this->zonesPerThread < zonesPerThread) {
+    this->zonesPerThread <<= 1;
+  }
+  startNanoseconds = getNanoseconds();
+  startTicks = now();
+  enabled = true;
+  registerThread("main");
+}
+
+void TraceRecorder::registerThread(const std::string& name) {
+  if (!enabled || getThreadBuffer() != nullptr) {
+    return;
+  }
+
+  auto threadBuffer = std::make_unique<ThreadBuffer>();
+  threadBuffer->zones.resize(zonesPerThread);
+  threadBuffer->mask = zonesPerThread - 1;
+
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  threadBuffer->id = static_cast<uint>(threads.size() + 1);
+  threadBuffer->name = name.empty() ? "thread " + std::to_string(threadBuffer->id) : name;
+  getThreadBuffer() = threadBuffer.get();
+  threads.push_back(std::move(threadBuffer));
+}
+
+// Chrome wants microseconds; keep the nanoseconds as decimals
+static void writeMicroseconds(std::ostream& os, double nanoseconds) {
+  os << std::fixed << std::setprecision(3) << nanoseconds / 1000.0;
+}
+
+bool TraceRecorder::writeJson(const std::string& fileName) {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create trace file " << fileName << std::endl;
+    return false;
+  }
+
+  // Ticks to time, from how far both have moved since we started
+  uint64_t elapsedTicks = now() - startTicks;
+  uint64_t elapsedNanoseconds = getNanoseconds() - startNanoseconds;
+  double nanosecondsPerTick = elapsedTicks > 0 ?
+    static_cast<double>(elapsedNanoseconds) / static_cast<double>(elapsedTicks) : 1.0;
+
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  uint64_t numDropped = 0;
+  bool first = true;
+
+  ofs << "{\"traceEvents\":[" << std::endl;
+  for (const auto& thread : threads) {
+    ofs << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id <<
+      ",\"args\":{\"name\":\"" << escapeJson(thread->name) << "\"}}";
+    first = false;
+
+    // Oldest first; a full ring starts just after the newest
+    uint64_t size = thread->zones.size();
+    uint64_t numKept = std::min(thread->numZones, size);
+    numDropped += thread->numZones - numKept;
+    for (uint64_t i = thread->numZones - numKept; i < thread->numZones; ++i) {
+      const Zone& zone = thread->zones[i % size];
+      uint64_t start = zone.start > startTicks ? zone.start - startTicks : 0;
+      ofs << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id << ",\"ts\":";
+      writeMicroseconds(ofs, start * nanosecondsPerTick);
+      ofs << ",\"dur\":";
+      writeMicroseconds(ofs, (zone.end - zone.start) * nanosecondsPerTick);
+      if (zone.argName != nullptr) {
+        ofs << ",\"args\":{\"" << zone.argName << "\":" << zone.arg << "}";
+      }
+      ofs << "}";
+    }
+  }
+  ofs << std::endl << "],\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedZones\":" << numDropped << "}}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing trace file " << fileName << std::endl;
+    return false;
+  }
+  if (numDropped > 0) {
+    std::cout << "Trace rings overflowed; the oldest " << numDropped << " zones were dropped" << std::endl;
+  }
+  return true;
+}
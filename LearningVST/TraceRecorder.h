@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+#include "Types.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TRACE_RECORDER_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define TRACE_RECORDER_TSC 0
+#endif
+
+// Records timed zones (plugin calls, host callbacks, encoding, I/O, MIDI
+// parsing) for viewing how they overlap across threads, in chrome://tracing
+// or Perfetto. Does nothing until enabled.
+//
+// Every thread records into its own ring of zones, so recording is two tick
+// counter reads and a store, with no locks; when a ring fills the oldest zones are
+// overwritten, so it can be left on for long renders. Rings are only read by
+// writeJson, once the threads that recorded have finished.
+class TraceRecorder {
+public:
+  static constexpr size_t kDefaultZonesPerThread = 1 << 16; // Rounded up to a power of two
+
+  // Zone names and argument names must be string literals (or otherwise
+  // outlive the recorder); only the pointer is kept
+  struct Zone {
+    const char* name;
+    const char* argName; // Null if the zone has no argument
+    int64_t arg;
+    uint64_t start; // Ticks (see now)
+    uint64_t end;
+  };
+
+protected:
+  struct ThreadBuffer {
+    std::string name;
+    uint id = 0;
+    std::vector<Zone> zones;
+    uint64_t numZones = 0; // Ever recorded; the next goes at numZones & mask
+    uint64_t mask = 0;
+  };
+
+  bool enabled = false;
+  size_t zonesPerThread = kDefaultZonesPerThread;
+  uint64_t startTicks = 0;
+  uint64_t startNanoseconds = 0; // Steady clock, for converting ticks
+  std::mutex threadsMutex; // Guards threads, which only change on registration
+  std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+  static ThreadBuffer*& getThreadBuffer() {
+    thread_local ThreadBuffer* threadBuffer = nullptr;
+    return threadBuffer;
+  }
+
+  TraceRecorder() {
+  }
+
+public:
+  static TraceRecorder& get() {
+    static TraceRecorder traceRecorder;
+    return traceRecorder;
+  }
+
+  // Starts recording; the calling thread is registered as "main"
+  void enable(size_t zonesPerThread = kDefaultZonesPerThread);
+
+  inline bool isEnabled() const {
+    return enabled;
+  }
+
+  // Monotonic ticks from an arbitrary start. On x86 that's the time stamp
+  // counter, which is constant rate on anything we'd run on and a fraction
+  // of the cost of the steady clock; writeJson converts to time.
+  static inline uint64_t now() {
+#if TRACE_RECORDER_TSC
+    return __rdtsc();
+#else
+    return getNanoseconds();
+#endif
+  }
+
+  static inline uint64_t getNanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  // Sets up the calling thread's ring, under a name for the trace viewer.
+  // Threads that record without registering (e.g. ones a plugin starts) get
+  // a ring on their first zone.
+  void registerThread(const std::string& name);
+
+  inline void record(const char* name, const char* argName, int64_t arg, uint64_t start, uint64_t end) {
+    ThreadBuffer* threadBuffer = getThreadBuffer();
+    if (threadBuffer == nullptr) {
+      registerThread("");
+      threadBuffer = getThreadBuffer();
+    }
+    Zone& zone = threadBuffer->zones[threadBuffer->numZones++ & threadBuffer->mask];
+    zone.name = name;
+    zone.argName = argName;
+    zone.arg = arg;
+    zone.start = start;
+    zone.end = end;
+  }
+
+  // Chrome trace event format (JSON object form)
+  bool writeJson(const std::string& fileName);
+};
+
+// Records the enclosing scope as a zone, if the recorder's enabled
+class TraceScope {
+protected:
+  const char* name;
+  const char* argName;
+  int64_t arg;
+  uint64_t start = 0;
+
+public:
+  inline TraceScope(const char* name, const char* argName = nullptr, int64_t arg = 0) {
+    this->name = name;
+    this->argName = argName;
+    this->arg = arg;
+    if (TraceRecorder::get().isEnabled()) {
+      start = TraceRecorder::now();
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  inline ~TraceScope() {
+    if (start != 0) {
+      TraceRecorder::get().record(name, argName, arg, start, TraceRecorder::now());
+    }
+  }
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <assert.h>
+#include "Types.h"
+#include "VstSdk.h"
+#include "Span.h"
+#include "MidiSource.h"
+
+// Ring of VstEvents arenas. Some plugins hold on to the VstEvents we pass to
+// effProcessEvents until the following processReplacing, so an arena is only
+// reused once the process call it was sent for has returned. Preparing and
+// dispatching are split so the next block's events can be prepared (even on
+// another thread; one producer, one consumer) while the current one renders.
+class VstEventRing {
+public:
+  static constexpr size_t kNumArenas = 3;
+
+protected:
+  enum class ArenaState {
+    Free,       // Ready to be prepared
+    Prepared,   // Filled in, waiting to be sent
+    Dispatched, // Sent to the plugin; owned by it until processReplacing returns
+  };
+
+  struct Arena {
+    std::vector<uchar> memory; // VstEvents struct and its array of VstEvent pointers
+    std::atomic<ArenaState> state{ ArenaState::Free };
+  };
+
+  std::array<Arena, kNumArenas> arenas;
+  ulong maxEvents = 0;
+
+  size_t prepareIndex = 0;  // Producer: next arena to prepare
+  size_t dispatchIndex = 0; // Consumer: next arena to send
+  size_t retireIndex = 0;   // Consumer: oldest arena the plugin may still hold
+  size_t numDispatched = 0; // Consumer: arenas sent since the last retire()
+
+public:
+  // Sizes every arena; call once before rendering
+  void allocate(ulong maxEvents) {
+    this->maxEvents = maxEvents;
+    for (auto& arena : arenas) {
+      arena.memory.resize(sizeof(VstEvents) + (maxEvents * sizeof(VstEvent*)));
+      arena.state.store(ArenaState::Free, std::memory_order_relaxed);
+    }
+    prepareIndex = dispatchIndex = retireIndex = numDispatched = 0;
+  }
+
+  inline ulong getMaxEvents() const {
+    return maxEvents;
+  }
+
+  // Producer: the next arena to fill in, or nullptr if the plugin still owns it
+  VstEvents* acquire() {
+    auto& arena = arenas[prepareIndex];
+    if (arena.state.load(std::memory_order_acquire) != ArenaState::Free) {
+      return nullptr;
+    }
+    return reinterpret_cast<VstEvents*>(arena.memory.data());
+  }
+
+  // Producer: hands the arena returned by acquire() over for dispatch
+  void publish() {
+    arenas[prepareIndex].state.store(ArenaState::Prepared, std::memory_order_release);
+    prepareIndex = (prepareIndex + 1) % kNumArenas;
+  }
+
+  // Producer: fills in and publishes the next arena with message events timed
+  // relative to startFrame. vstMidiEvents are the ones built when the MIDI file
+  // was parsed (see MidiTrack::vstSequence), one per midiEvent; only their
+  // timing is filled in. Returns false if the plugin still owns every arena;
+  // numDropped is how many events didn't fit.
+  bool prepare(Span<const MidiEvent> midiEvents, Span<VstMidiEvent> vstMidiEvents, ulong startFrame,
+    size_t& numDropped) {
+    assert(midiEvents.size() == vstMidiEvents.size());
+
+    numDropped = 0;
+    VstEvents* vstEvents = acquire();
+    if (vstEvents == nullptr) {
+      return false;
+    }
+
+    // Storage was sized by allocate() for the densest block in the sequence
+    size_t numEvents = midiEvents.size();
+    if (numEvents > maxEvents) {
+      numDropped = numEvents - maxEvents;
+      numEvents = maxEvents;
+    }
+
+    // Point at the events and set their offsets into this block
+    vstEvents->numEvents = static_cast<VstInt32>(numEvents);
+    for (size_t i = 0; i < numEvents; ++i) {
+      assert(midiEvents[i].eventType == MidiEvent::EventType::Message);
+      vstMidiEvents[i].deltaFrames = static_cast<VstInt32>(midiEvents[i].timeStamp - startFrame);
+      vstEvents->events[i] = reinterpret_cast<VstEvent*>(&vstMidiEvents[i]);
+    }
+
+    publish();
+    return true;
+  }
+
+  // Consumer: the next prepared arena, now owned by the plugin, or nullptr
+  VstEvents* dispatch() {
+    auto& arena = arenas[dispatchIndex];
+    if (arena.state.load(std::memory_order_acquire) != ArenaState::Prepared) {
+      return nullptr;
+    }
+    arena.state.store(ArenaState::Dispatched, std::memory_order_relaxed);
+    dispatchIndex = (dispatchIndex + 1) % kNumArenas;
+    ++numDispatched;
+    return reinterpret_cast<VstEvents*>(arena.memory.data());
+  }
+
+  // Consumer: processReplacing has returned, so every dispatched arena is free
+  void retire() {
+    for (; numDispatched > 0; --numDispatched) {
+      arenas[retireIndex].state.store(ArenaState::Free, std::memory_order_release);
+      retireIndex = (retireIndex + 1) % kNumArenas;
+    }
+  }
+};
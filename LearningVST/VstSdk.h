@@ -0,0 +1,6 @@
+#pragma once
+
+// VST2.X SDK; include this rather than aeffectx.h directly so every file
+// sees the same configuration
+#define VST_FORCE_DEPRECATED 0 // TODO: See if we really need to do this
+#include "aeffectx.h"
@@ -0,0 +1,139 @@
+#include "WaveformPeaks.h"
+#include <iostream>
+#include <filesystem>
+#include "MappedFile.h"
+
+std::string WaveformPeaks::getFileName(const std::string& audioFileName) {
+  std::filesystem::path path(audioFileName);
+  path.replace_extension(".peaks");
+  return path.string();
+}
+
+bool WaveformPeaks::openWrite(const std::string& fileName, ushort numChannels, uint sampleRate) {
+  this->fileName = getFileName(fileName);
+
+  header = Header();
+  header.numChannels = numChannels;
+  header.sampleRate = sampleRate;
+  for (uint level = 0; level < kNumLevels; ++level) {
+    header.levels[level].samplesPerBin = kSamplesPerBin[level];
+  }
+
+  bins.resize(numChannels);
+  startBin();
+
+  // Header's a placeholder until closeWrite
+  ofs.open(this->fileName, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create peak file " << this->fileName << std::endl;
+    return false;
+  }
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  return true;
+}
+
+void WaveformPeaks::processSilence(ulong numFrames) {
+  const uint samplesPerBin = kSamplesPerBin[0];
+  header.numFrames += numFrames;
+
+  for (ulong offset = 0; offset < numFrames; ) {
+    ulong binFrames = std::min(numFrames - offset, static_cast<ulong>(samplesPerBin - framesInBin));
+    for (auto& bin : bins) {
+      bin.minValue = std::min(bin.minValue, 0.0f);
+      bin.maxValue = std::max(bin.maxValue, 0.0f);
+    }
+
+    offset += binFrames;
+    framesInBin += binFrames;
+    if (framesInBin == samplesPerBin) {
+      endBin();
+    }
+  }
+}
+
+bool WaveformPeaks::closeWrite() {
+  if (!ofs.is_open()) {
+    return false;
+  }
+
+  if (framesInBin > 0) {
+    endBin();
+  }
+  ofs.close();
+  if (!ofs) {
+    std::cerr << "Error while writing peak file " << fileName << std::endl;
+    return false;
+  }
+
+  const size_t numChannels = header.numChannels;
+  for (uint level = 0; level < kNumLevels; ++level) {
+    header.levels[level].numBins = (header.numFrames + kSamplesPerBin[level] - 1) / kSamplesPerBin[level];
+  }
+
+  // The finest level is on disk; scale it if need be, and fold the coarser
+  // levels from it, each from the one before
+  std::vector<std::vector<Bin>> levels(kNumLevels);
+  {
+    MappedFile mappedFile;
+    if (!mappedFile.open(fileName, true)) {
+      return false;
+    }
+
+    Bin* finest = reinterpret_cast<Bin*>(mappedFile.getData() + sizeof(Header));
+    if (outputGain != 1.0) {
+      AudioKernels::scale(reinterpret_cast<float*>(finest),
+        header.levels[0].numBins * numChannels * 2, static_cast<float>(outputGain));
+    }
+
+    const Bin* finer = finest;
+    for (uint level = 1; level < kNumLevels; ++level) {
+      const uint64_t binsPerBin = kSamplesPerBin[level] / kSamplesPerBin[level - 1];
+      const uint64_t numFinerBins = header.levels[level - 1].numBins;
+      levels[level].resize(header.levels[level].numBins * numChannels);
+
+      for (uint64_t bin = 0; bin < header.levels[level].numBins; ++bin) {
+        Bin* coarse = &levels[level][bin * numChannels];
+        for (size_t c = 0; c < numChannels; ++c) {
+          coarse[c].minValue = std::numeric_limits<float>::infinity();
+          coarse[c].maxValue = -std::numeric_limits<float>::infinity();
+        }
+
+        uint64_t lastFinerBin = std::min((bin + 1) * binsPerBin, numFinerBins);
+        for (uint64_t finerBin = bin * binsPerBin; finerBin < lastFinerBin; ++finerBin) {
+          const Bin* fine = &finer[finerBin * numChannels];
+          for (size_t c = 0; c < numChannels; ++c) {
+            coarse[c].minValue = std::min(coarse[c].minValue, fine[c].minValue);
+            coarse[c].maxValue = std::max(coarse[c].maxValue, fine[c].maxValue);
+          }
+        }
+      }
+      finer = levels[level].data();
+    }
+
+    if (!mappedFile.close()) {
+      std::cerr << "Error while writing peak file " << fileName << std::endl;
+      return false;
+    }
+  }
+
+  // Coarser levels go after it, then the real header goes in
+  std::fstream fs(fileName, std::ios::binary | std::ios::in | std::ios::out);
+  uint64_t offset = sizeof(Header);
+  fs.seekp(0, std::ios::end);
+  for (uint level = 0; level < kNumLevels; ++level) {
+    header.levels[level].offset = offset;
+    offset += header.levels[level].numBins * numChannels * sizeof(Bin);
+    if (level > 0) {
+      fs.write(reinterpret_cast<const char*>(levels[level].data()), levels[level].size() * sizeof(Bin));
+    }
+  }
+  fs.seekp(0, std::ios::beg);
+  fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  fs.flush();
+  if (!fs.good()) {
+    std::cerr << "Error while writing peak file " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
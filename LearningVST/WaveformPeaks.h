@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <stdint.h>
+#include "Types.h"
+#include "AudioKernels.h"
+
+// Waveform overviews for the review UI, built as we render so it never has to
+// read the audio: the min and max of each channel over every bin of
+// samplesPerBin frames, at a few zoom levels.
+//
+// The .peaks file is little endian: a Header, then each level's bins in
+// order, every bin being a min/max pair of floats per channel. The finest
+// level is streamed to disk while rendering; the coarser ones are folded from
+// it at close and appended, and the header filled in.
+class WaveformPeaks {
+public:
+  static constexpr uint kNumLevels = 3;
+  static constexpr uint kVersion = 1;
+
+  // Each a multiple of the one before
+  static constexpr uint kSamplesPerBin[kNumLevels] = { 256, 4096, 65536 };
+
+#pragma pack(push, 1)
+  struct Header {
+    char fileId[4] = { 'P', 'E', 'A', 'K' };
+    uint version = kVersion;
+    uint numChannels = 0;
+    uint sampleRate = 0;
+    uint64_t numFrames = 0;
+    uint numLevels = kNumLevels;
+
+    struct Level {
+      uint samplesPerBin = 0;
+      uint64_t numBins = 0; // The last one may be partial
+      uint64_t offset = 0;  // From the start of the file
+    } levels[kNumLevels];
+  };
+
+  struct Bin {
+    float minValue;
+    float maxValue;
+  };
+#pragma pack(pop)
+
+protected:
+  Header header;
+  std::string fileName;
+  std::ofstream ofs;
+  std::vector<Bin> bins; // The finest level's current bin, one per channel
+  uint framesInBin = 0;
+  double outputGain = 1.0;
+
+  inline void startBin() {
+    for (auto& bin : bins) {
+      bin.minValue = std::numeric_limits<float>::infinity();
+      bin.maxValue = -std::numeric_limits<float>::infinity();
+    }
+    framesInBin = 0;
+  }
+
+  inline void endBin() {
+    ofs.write(reinterpret_cast<const char*>(bins.data()), bins.size() * sizeof(Bin));
+    startBin();
+  }
+
+public:
+  // fileName is the WAV file; the peaks go next to it (see getFileName)
+  bool openWrite(const std::string& fileName, ushort numChannels, uint sampleRate);
+
+  // numFrames from one pointer per channel
+  template <typename T> void process(const T* const* channels, ulong numFrames);
+
+  // Frames of digital silence
+  void processSilence(ulong numFrames);
+
+  // Gain applied to the audio after it went past us (e.g. normalization)
+  inline void setOutputGain(double gain) {
+    outputGain = gain;
+  }
+
+  bool closeWrite();
+
+  // audioFileName with a .peaks extension instead
+  static std::string getFileName(const std::string& audioFileName);
+};
+
+template <typename T> void WaveformPeaks::process(const T* const* channels, ulong numFrames) {
+  const uint samplesPerBin = kSamplesPerBin[0];
+  header.numFrames += numFrames;
+
+  // Bins don't line up with blocks, so take the block a bin's worth at a time
+  for (ulong offset = 0; offset < numFrames; ) {
+    ulong binFrames = std::min(numFrames - offset, static_cast<ulong>(samplesPerBin - framesInBin));
+    for (size_t c = 0; c < bins.size(); ++c) {
+      T minValue = bins[c].minValue;
+      T maxValue = bins[c].maxValue;
+      AudioKernels::minMax(channels[c] + offset, binFrames, minValue, maxValue);
+      bins[c].minValue = static_cast<float>(minValue);
+      bins[c].maxValue = static_cast<float>(maxValue);
+    }
+
+    offset += binFrames;
+    framesInBin += binFrames;
+    if (framesInBin == samplesPerBin) {
+      endBin();
+    }
+  }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "Types.h"
+
+// Streaming XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md).
+// Feed it any number of update calls; digest gives the same value as hashing
+// everything in one go with the reference implementation.
+class Xxh64 {
+public:
+  static constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  static constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  static constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  static constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+  static constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+  static constexpr size_t kStripeBytes = 32;
+
+protected:
+  uint64_t seed = 0;
+  uint64_t accumulators[4];
+  uint64_t totalBytes = 0;
+  uchar stripe[kStripeBytes]; // Bytes left over from the last update
+  size_t stripeBytes = 0;
+
+  static inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  // Little endian, whatever the alignment
+  static inline uint64_t read64(const uchar* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static inline uint32_t read32(const uchar* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static inline uint64_t round(uint64_t accumulator, uint64_t lane) {
+    accumulator += lane * kPrime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * kPrime1;
+  }
+
+  static inline uint64_t mergeAccumulator(uint64_t hash, uint64_t accumulator) {
+    hash ^= round(0, accumulator);
+    return (hash * kPrime1) + kPrime4;
+  }
+
+  inline void consumeStripe(const uchar* data) {
+    accumulators[0] = round(accumulators[0], read64(data));
+    accumulators[1] = round(accumulators[1], read64(data + 8));
+    accumulators[2] = round(accumulators[2], read64(data + 16));
+    accumulators[3] = round(accumulators[3], read64(data + 24));
+  }
+
+public:
+  Xxh64(uint64_t seed = 0) {
+    reset(seed);
+  }
+
+  inline void reset(uint64_t seed = 0) {
+    this->seed = seed;
+    accumulators[0] = seed + kPrime1 + kPrime2;
+    accumulators[1] = seed + kPrime2;
+    accumulators[2] = seed;
+    accumulators[3] = seed - kPrime1;
+    totalBytes = 0;
+    stripeBytes = 0;
+  }
+
+  inline void update(const void* data, size_t size) {
+    const uchar* bytes = static_cast<const uchar*>(data);
+    totalBytes += size;
+
+    // Top up a partial stripe first
+    if (stripeBytes > 0) {
+      size_t numBytes = std::min(size, kStripeBytes - stripeBytes);
+      memcpy(stripe + stripeBytes, bytes, numBytes);
+      stripeBytes += numBytes;
+      bytes += numBytes;
+      size -= numBytes;
+      if (stripeBytes < kStripeBytes) {
+        return;
+      }
+      consumeStripe(stripe);
+      stripeBytes = 0;
+    }
+
+    // Then straight from the caller's memory
+    const uchar* end = bytes + size;
+    for (; bytes + kStripeBytes <= end; bytes += kStripeBytes) {
+      consumeStripe(bytes);
+    }
+
+    stripeBytes = end - bytes;
+    memcpy(stripe, bytes, stripeBytes);
+  }
+
+  inline uint64_t digest() const {
+    uint64_t hash;
+    if (totalBytes >= kStripeBytes) {
+      hash = rotateLeft(accumulators[0], 1) + rotateLeft(accumulators[1], 7) +
+        rotateLeft(accumulators[2], 12) + rotateLeft(accumulators[3], 18);
+      for (int i = 0; i < 4; ++i) {
+        hash = mergeAccumulator(hash, accumulators[i]);
+      }
+    }
+    else {
+      hash = seed + kPrime5;
+    }
+    hash += totalBytes;
+
+    // Whatever didn't fill a stripe
+    const uchar* bytes = stripe;
+    const uchar* end = stripe + stripeBytes;
+    for (; bytes + 8 <= end; bytes += 8) {
+      hash ^= round(0, read64(bytes));
+      hash = (rotateLeft(hash, 27) * kPrime1) + kPrime4;
+    }
+    if (bytes + 4 <= end) {
+      hash ^= read32(bytes) * kPrime1;
+      hash = (rotateLeft(hash, 23) * kPrime2) + kPrime3;
+      bytes += 4;
+    }
+    for (; bytes < end; ++bytes) {
+      hash ^= *bytes * kPrime5;
+      hash = rotateLeft(hash, 11) * kPrime1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+  // The usual 16 hex digit form, as xxhsum prints it
+  static std::string toString(uint64_t digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(16, '0');
+    for (int i = 15; i >= 0; --i, digest >>= 4) {
+      text[i] = digits[digest & 0xF];
+    }
+    return text;
+  }
+};
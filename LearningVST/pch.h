@@ -10,6 +10,8 @@
 #define PCH_H
 
 // TODO: add headers that you want to pre-compile here
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 #endif //PCH_H
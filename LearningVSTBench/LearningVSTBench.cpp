@@ -0,0 +1,712 @@
+// LearningVSTBench.cpp : Microbenchmarks for the render pipeline's inner loops.
+//
+// Usage: LearningVSTBench [--json=FILE] [--midi_corpus=DIR] [--min_seconds=S]
+//                         [--midi_seed=N] [--midi_scale=X]
+//
+// --json writes every result to FILE as well, in a fixed layout (see
+// writeJson) so runs from different commits can be compared. --midi_corpus
+// adds every .mid file in DIR to the MIDI parsing and event packing runs.
+// --midi_seed and --midi_scale change the synthetic MIDI files (see
+// writeSyntheticMidi); keep them the same between runs you compare.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+#include "Types.h"
+#include "ChannelCount.h"
+#include "SampleBuffer.h"
+#include "AudioKernels.h"
+#include "TraceRecorder.h"
+#include "AllocationCounter.h"
+#include "MidiSource.h"
+#include "VstEventRing.h"
+#include "PcmWavFile.h"
+#include "MidiGenerator.h"
+#include "ReferenceInstrument.h"
+#include "Span.h"
+#include "Json.h"
+
+// Results are folded in here so the optimizer can't discard the work
+static volatile uint benchmarkSink = 0;
+
+static double minSecondsPerBenchmark = 0.25;
+static uint64_t midiSeed = 5678;
+static double midiScale = 1.0;
+
+// One line of the JSON output. Rates that don't apply to a benchmark are
+// left empty and written as null.
+struct BenchmarkResult {
+  std::string name;
+  double nsPerIteration = 0.0;
+  std::optional<double> nsPerEvent;
+  std::optional<double> eventsPerSecond;
+  std::optional<double> samplesPerSecond;
+  std::optional<uint64_t> bytesAllocated; // Per iteration; only known when allocations are counted
+};
+
+static std::vector<BenchmarkResult> benchmarkResults;
+
+// Bytes func allocates in one call, if this build counts them
+template <typename Func> std::optional<uint64_t> measureAllocation(Func func) {
+  if (!AllocationCounter::isEnabled()) {
+    return std::nullopt;
+  }
+  uint64_t bytesBefore = AllocationCounter::getBytes();
+  func();
+  return AllocationCounter::getBytes() - bytesBefore;
+}
+
+// Runs func until at least minSeconds have passed; returns seconds per call
+template <typename Func> double measure(Func func, double minSeconds = minSecondsPerBenchmark) {
+  // Warm caches and branch predictors first
+  func();
+
+  ulong iterations = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed(0.0);
+  do {
+    func();
+    ++iterations;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < minSeconds);
+
+  return elapsed.count() / static_cast<double>(iterations);
+}
+
+static void fillNoise(VstSampleBuffer& sampleBuffer) {
+  std::mt19937 generator(1234);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  for (ushort c = 0; c < sampleBuffer.getNumChannels(); ++c) {
+    for (ulong s = 0; s < sampleBuffer.getBlockSize(); ++s) {
+      sampleBuffer.getSamples()[c][s] = distribution(generator);
+    }
+  }
+}
+
+// PCM converter throughput on aligned versus packed buffers. Odd block sizes
+// are included because that's where packed channels start mid cache line.
+static void benchmarkConverters() {
+  const ushort numChannels = 2;
+  const ulong blockSizes[] = { 512, 511, 4096, 4093 };
+  const SampleBufferLayout layouts[] = { SampleBufferLayout::Aligned, SampleBufferLayout::Packed };
+
+  std::cout << std::left << std::setw(12) << "converter" << std::setw(10) << "layout" <<
+    std::setw(8) << "frames" << std::right << std::setw(14) << "Msamples/s" << std::endl;
+
+  for (auto blockSize : blockSizes) {
+    for (auto layout : layouts) {
+      VstSampleBuffer sampleBuffer(numChannels, blockSize, layout);
+      fillNoise(sampleBuffer);
+
+      const float* const* channels = sampleBuffer.getSamples();
+      std::vector<uchar> pcmBuffer(numChannels * blockSize * sizeof(int));
+
+      struct Converter {
+        const char* name;
+        double maxValue;
+        void (*encode)(const float* const*, ushort, ulong, double, uchar*);
+      } converters[] = {
+        { "pcm8", 127.0, [](const float* const* in, ushort nc, ulong nf, double mv, uchar* out) {
+          AudioKernels::encodePcm8(in, nc, nf, mv, out); } },
+        { "pcm16", 32767.0, [](const float* const* in, ushort nc, ulong nf, double mv, uchar* out) {
+          AudioKernels::encodePcm16(in, nc, nf, mv, reinterpret_cast<short*>(out)); } },
+        { "pcm24", 8388607.0, [](const float* const* in, ushort nc, ulong nf, double mv, uchar* out) {
+          AudioKernels::encodePcm24(in, nc, nf, mv, out); } },
+        { "pcm32", 2147483647.0, [](const float* const* in, ushort nc, ulong nf, double mv, uchar* out) {
+          AudioKernels::encodePcm32(in, nc, nf, mv, reinterpret_cast<int*>(out)); } },
+        { "peak", 0.0, [](const float* const* in, ushort nc, ulong nf, double, uchar* out) {
+          for (ushort c = 0; c < nc; ++c) {
+            out[c] = static_cast<uchar>(AudioKernels::peakAbs(in[c], nf) * 255.0f);
+          } } },
+      };
+
+      for (const auto& converter : converters) {
+        double secondsPerCall = measure([&]() {
+          converter.encode(channels, numChannels, blockSize, converter.maxValue, pcmBuffer.data());
+          benchmarkSink += pcmBuffer[blockSize];
+        });
+
+        double samplesPerSecond = static_cast<double>(numChannels * blockSize) / secondsPerCall;
+        BenchmarkResult result;
+        result.name = std::string("convert/") + converter.name + "/" +
+          (layout == SampleBufferLayout::Aligned ? "aligned" : "packed") + "/" + std::to_string(blockSize);
+        result.nsPerIteration = secondsPerCall * 1e9;
+        result.samplesPerSecond = samplesPerSecond;
+        benchmarkResults.push_back(result);
+
+        std::cout << std::left << std::setw(12) << converter.name <<
+          std::setw(10) << (layout == SampleBufferLayout::Aligned ? "aligned" : "packed") <<
+          std::setw(8) << blockSize << std::right << std::setw(14) << std::fixed <<
+          std::setprecision(1) << samplesPerSecond / 1.0e6 << std::endl;
+      }
+    }
+  }
+}
+
+// Times the 16 and 24-bit converters over numChannels channels, with the
+// channel count left to run time and, if there's a specialization for it,
+// fixed at compile time as kChannels
+template <ushort kChannels> static void benchmarkChannelCount(ushort numChannels) {
+  const ulong blockSize = 4096;
+  VstSampleBuffer sampleBuffer(numChannels, blockSize);
+  fillNoise(sampleBuffer);
+
+  const float* const* channels = sampleBuffer.getSamples();
+  std::vector<uchar> pcmBuffer(numChannels * blockSize * sizeof(int));
+
+  auto report = [&](const char* name, const char* channelCount, double secondsPerCall) {
+    double samplesPerSecond = static_cast<double>(numChannels * blockSize) / secondsPerCall;
+    BenchmarkResult result;
+    result.name = std::string("channels/") + name + "/" + channelCount + "/" + std::to_string(numChannels);
+    result.nsPerIteration = secondsPerCall * 1e9;
+    result.samplesPerSecond = samplesPerSecond;
+    benchmarkResults.push_back(result);
+
+    std::cout << std::left << std::setw(12) << name << std::setw(10) << channelCount <<
+      std::setw(8) << numChannels << std::right << std::setw(14) << std::fixed <<
+      std::setprecision(1) << samplesPerSecond / 1.0e6 << std::endl;
+  };
+
+  report("pcm16", "dynamic", measure([&]() {
+    AudioKernels::encodePcm16(channels, numChannels, blockSize, 32767.0, reinterpret_cast<short*>(pcmBuffer.data()));
+    benchmarkSink += pcmBuffer[blockSize];
+  }));
+  report("pcm24", "dynamic", measure([&]() {
+    AudioKernels::encodePcm24(channels, numChannels, blockSize, 8388607.0, pcmBuffer.data());
+    benchmarkSink += pcmBuffer[blockSize];
+  }));
+
+  if constexpr (kChannels != kDynamicChannels) {
+    report("pcm16", "fixed", measure([&]() {
+      AudioKernels::encodePcm16<kChannels>(channels, numChannels, blockSize, 32767.0, reinterpret_cast<short*>(pcmBuffer.data()));
+      benchmarkSink += pcmBuffer[blockSize];
+    }));
+    report("pcm24", "fixed", measure([&]() {
+      AudioKernels::encodePcm24<kChannels>(channels, numChannels, blockSize, 8388607.0, pcmBuffer.data());
+      benchmarkSink += pcmBuffer[blockSize];
+    }));
+  }
+}
+
+// Converter throughput for each channel count we specialize, and for wide
+// buses which always take the dynamic path
+static void benchmarkChannelCounts() {
+  std::cout << std::left << std::setw(12) << "converter" << std::setw(10) << "count" <<
+    std::setw(8) << "channels" << std::right << std::setw(14) << "Msamples/s" << std::endl;
+
+  const ushort numChannelsList[] = { 1, 2, 8, 16, 32 };
+  for (auto numChannels : numChannelsList) {
+    dispatchChannelCount(numChannels, [&](auto channelCount) {
+      benchmarkChannelCount<decltype(channelCount)::value>(numChannels);
+    });
+  }
+
+  // 5.1 measured slower fixed than dynamic, so dispatchChannelCount leaves it
+  // dynamic; both are still timed here in case that changes
+  benchmarkChannelCount<6>(6);
+}
+
+// Cost of a trace zone, which has to stay cheap enough to leave tracing on
+static void benchmarkTraceZones() {
+  const ulong numZones = 10000;
+  auto recordZones = []() {
+    for (ulong i = 0; i < numZones; ++i) {
+      TraceScope traceScope("benchmark", "index", i);
+      benchmarkSink = benchmarkSink + 1;
+    }
+  };
+
+  std::cout << std::left << std::setw(12) << "trace zone" << std::right << std::setw(14) << "ns/zone" << std::endl;
+
+  auto report = [](const char* name, double secondsPerCall) {
+    BenchmarkResult result;
+    result.name = std::string("traceZone/") + name;
+    result.nsPerIteration = secondsPerCall * 1e9;
+    result.nsPerEvent = secondsPerCall * 1e9 / numZones;
+    result.eventsPerSecond = numZones / secondsPerCall;
+    benchmarkResults.push_back(result);
+
+    std::cout << std::left << std::setw(12) << name << std::right << std::setw(14) << *result.nsPerEvent << std::endl;
+  };
+
+  report("disabled", measure(recordZones));
+  TraceRecorder::get().enable();
+  report("enabled", measure(recordZones));
+}
+
+// A MIDI file to parse and play through the event path
+struct MidiInput {
+  std::string name;
+  std::string fileName;
+};
+
+// Synthetic files written to dir: every MidiGenerator profile, then the dense
+// profile at growing lengths to show how parsing and packing scale with file
+// size. The same seed always gives the same files, so results are comparable
+// between runs and machines; --midi_scale stretches every profile's length.
+static std::vector<MidiInput> writeSyntheticMidi(const std::filesystem::path& dir) {
+  std::vector<MidiInput> inputs;
+  auto add = [&](const std::string& name, MidiGeneratorProfile profile) {
+    profile.seconds *= midiScale;
+    std::string fileName = (dir / (profile.name + ".mid")).string();
+    if (MidiGenerator(profile, midiSeed).generate(0).write(fileName, 0)) {
+      inputs.push_back({ name, fileName });
+    }
+  };
+
+  for (const auto& profile : MidiGenerator::getProfiles()) {
+    add("synthetic/" + profile.name, profile);
+  }
+
+  for (double seconds : { 15.0, 60.0, 240.0 }) {
+    MidiGeneratorProfile profile = *MidiGenerator::findProfile("dense");
+    profile.seconds = seconds;
+    profile.name = "dense_" + std::to_string(static_cast<int>(seconds)) + "s";
+    add("sweep/" + profile.name, profile);
+  }
+
+  return inputs;
+}
+
+static std::vector<MidiInput> findCorpusMidi(const std::string& corpusDir) {
+  std::vector<MidiInput> inputs;
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(corpusDir, error)) {
+    std::string extension = entry.path().extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (entry.is_regular_file() && (extension == ".mid" || extension == ".midi")) {
+      inputs.push_back({ "corpus/" + entry.path().filename().string(), entry.path().string() });
+    }
+  }
+  if (error) {
+    std::cerr << "Unable to read MIDI corpus " << corpusDir << ": " << error.message() << std::endl;
+  }
+
+  // Directory order isn't stable between machines
+  std::sort(inputs.begin(), inputs.end(), [](const MidiInput& a, const MidiInput& b) { return a.name < b.name; });
+  return inputs;
+}
+
+// MidiSource::openFile, which is mostly readTrack, per file
+static void benchmarkMidiParsing(const std::vector<MidiInput>& inputs) {
+  std::cout << std::left << std::setw(28) << "midi parse" << std::right << std::setw(10) << "events" <<
+    std::setw(12) << "ns/event" << std::setw(12) << "Mevents/s" << std::setw(12) << "KB alloc" << std::endl;
+
+  for (const auto& input : inputs) {
+    size_t numEvents = 0;
+    {
+      MidiSource midiSource;
+      if (!midiSource.openFile(input.fileName)) {
+        continue;
+      }
+      for (const auto& track : midiSource.getTracks()) {
+        numEvents += track.events.size();
+      }
+    }
+    if (numEvents == 0) {
+      continue;
+    }
+
+    auto parse = [&]() {
+      MidiSource midiSource;
+      midiSource.openFile(input.fileName);
+      benchmarkSink += static_cast<uint>(midiSource.getTrackCount());
+    };
+    BenchmarkResult result;
+    result.name = "midiParse/" + input.name;
+    result.bytesAllocated = measureAllocation(parse);
+    double secondsPerCall = measure(parse);
+    result.nsPerIteration = secondsPerCall * 1e9;
+    result.nsPerEvent = secondsPerCall * 1e9 / numEvents;
+    result.eventsPerSecond = numEvents / secondsPerCall;
+    benchmarkResults.push_back(result);
+
+    std::cout << std::left << std::setw(28) << input.name << std::right << std::setw(10) << numEvents <<
+      std::fixed << std::setprecision(1) << std::setw(12) << *result.nsPerEvent <<
+      std::setw(12) << *result.eventsPerSecond / 1e6 << std::setw(12) <<
+      (result.bytesAllocated ? std::to_string(*result.bytesAllocated / 1024) : std::string("-")) << std::endl;
+  }
+}
+
+// The per-block event path (VstEventRing::prepare, dispatch and retire, as
+// VstPlugin::prepareMidiEvents, processMidiEvents and processAudio do) over a
+// whole track, less the plugin itself
+static void benchmarkEventPacking(const std::vector<MidiInput>& inputs) {
+  const ulong blockSize = 512;
+
+  std::cout << std::left << std::setw(28) << "event packing" << std::right << std::setw(10) << "events" <<
+    std::setw(12) << "ns/event" << std::setw(12) << "Mevents/s" << std::setw(12) << "KB alloc" << std::endl;
+
+  for (const auto& input : inputs) {
+    MidiSource midiSource;
+    if (!midiSource.openFile(input.fileName) || midiSource.getTrackCount() == 0) {
+      continue;
+    }
+    MidiTrack& track = midiSource.getTracks()[0];
+    const auto& sequence = track.sequence;
+
+    // Runs of messages within a block, as the render loop would send them;
+    // meta events split blocks there too
+    struct Run {
+      size_t first;
+      size_t size;
+      ulong startFrame;
+    };
+    std::vector<Run> runs;
+    size_t maxRun = 0;
+    for (size_t i = 0; i < sequence.size();) {
+      if (sequence[i].eventType != MidiEvent::EventType::Message) {
+        ++i;
+        continue;
+      }
+      ulong startFrame = sequence[i].timeStamp - sequence[i].timeStamp % blockSize;
+      size_t first = i;
+      while (i < sequence.size() && sequence[i].eventType == MidiEvent::EventType::Message &&
+        sequence[i].timeStamp < startFrame + blockSize) {
+        ++i;
+      }
+      runs.push_back({ first, i - first, startFrame });
+      maxRun = std::max(maxRun, i - first);
+    }
+    size_t numEvents = 0;
+    for (const auto& run : runs) {
+      numEvents += run.size;
+    }
+    if (numEvents == 0) {
+      continue;
+    }
+
+    VstEventRing eventRing;
+    eventRing.allocate(static_cast<ulong>(maxRun));
+    auto pack = [&]() {
+      for (const auto& run : runs) {
+        size_t numDropped;
+        eventRing.prepare(Span<const MidiEvent>(sequence.data() + run.first, run.size),
+          Span<VstMidiEvent>(track.vstSequence.data() + run.first, run.size), run.startFrame, numDropped);
+        VstEvents* vstEvents = eventRing.dispatch();
+        benchmarkSink += static_cast<uint>(vstEvents->numEvents);
+        eventRing.retire();
+      }
+    };
+
+    BenchmarkResult result;
+    result.name = "eventPacking/" + input.name;
+    result.bytesAllocated = measureAllocation(pack);
+    double secondsPerCall = measure(pack);
+    result.nsPerIteration = secondsPerCall * 1e9;
+    result.nsPerEvent = secondsPerCall * 1e9 / numEvents;
+    result.eventsPerSecond = numEvents / secondsPerCall;
+    benchmarkResults.push_back(result);
+
+    std::cout << std::left << std::setw(28) << input.name << std::right << std::setw(10) << numEvents <<
+      std::fixed << std::setprecision(1) << std::setw(12) << *result.nsPerEvent <<
+      std::setw(12) << *result.eventsPerSecond / 1e6 << std::setw(12) <<
+      (result.bytesAllocated ? std::to_string(*result.bytesAllocated / 1024) : std::string("-")) << std::endl;
+  }
+}
+
+// Stands in for the host's callback; the reference instrument asks for the
+// transport once per block
+static VstIntPtr VSTCALLBACK benchmarkHostCallback(AEffect*, VstInt32 opCode, VstInt32, VstIntPtr, void*,
+  float) {
+  static VstTimeInfo timeInfo = { };
+  if (opCode == audioMasterGetTime) {
+    return reinterpret_cast<VstIntPtr>(&timeInfo);
+  }
+  return 0;
+}
+
+// A whole track through the reference instrument, block by block as the
+// render loop drives a plugin (events packed and sent, then processReplacing),
+// with and without synthetic load per voice. Only the shorter inputs; the
+// point is a stable number to compare between commits, not a long render.
+static void benchmarkReferenceInstrument(const std::vector<MidiInput>& inputs) {
+  const ulong blockSize = 512;
+  const char* inputNames[] = { "synthetic/sparse", "synthetic/dense", "synthetic/cc_flood", "synthetic/edge_cases" };
+  const uint burns[] = { 0, 16 };
+
+  std::cout << std::left << std::setw(28) << "reference instrument" << std::setw(8) << "burn" << std::right <<
+    std::setw(10) << "blocks" << std::setw(12) << "us/block" << std::setw(12) << "x realtime" << std::setw(12) <<
+    "KB alloc" << std::endl;
+
+  for (const auto& input : inputs) {
+    if (std::find_if(std::begin(inputNames), std::end(inputNames),
+      [&](const char* name) { return input.name == name; }) == std::end(inputNames)) {
+      continue;
+    }
+
+    MidiSource midiSource;
+    if (!midiSource.openFile(input.fileName) || midiSource.getTrackCount() == 0) {
+      continue;
+    }
+    MidiTrack& track = midiSource.getTracks()[0];
+    const auto& sequence = track.sequence;
+    if (sequence.empty()) {
+      continue;
+    }
+
+    // Sub-blocks of messages, split at meta events as the render loop splits
+    // its blocks; the metas themselves never reach the instrument
+    struct Run {
+      size_t first;
+      size_t size;
+      ulong startFrame;
+      ulong numFrames;
+    };
+    ulong numBlocks = sequence.back().timeStamp / blockSize + 1;
+    std::vector<Run> runs;
+    size_t maxRun = 1;
+    {
+      size_t i = 0;
+      for (ulong block = 0; block < numBlocks; ++block) {
+        ulong blockEndFrame = (block + 1) * blockSize;
+        ulong startFrame = block * blockSize;
+        while (startFrame < blockEndFrame) {
+          while (i < sequence.size() && sequence[i].eventType != MidiEvent::EventType::Message &&
+            sequence[i].timeStamp <= startFrame) {
+            ++i;
+          }
+          size_t first = i;
+          while (i < sequence.size() && sequence[i].eventType == MidiEvent::EventType::Message &&
+            sequence[i].timeStamp < blockEndFrame) {
+            ++i;
+          }
+          ulong endFrame = blockEndFrame;
+          if (i < sequence.size() && sequence[i].timeStamp < blockEndFrame) {
+            if (sequence[i].timeStamp > startFrame) {
+              endFrame = sequence[i].timeStamp;
+            }
+            else {
+              ++i;
+            }
+          }
+          runs.push_back({ first, i - first, startFrame, endFrame - startFrame });
+          maxRun = std::max(maxRun, i - first);
+          startFrame = endFrame;
+        }
+      }
+    }
+
+    for (uint burn : burns) {
+      ReferenceInstrument::Settings settings;
+      settings.burnPerVoice = burn;
+      AEffect* effect = ReferenceInstrument::create(settings, benchmarkHostCallback);
+      effect->dispatcher(effect, effSetSampleRate, 0, 0, nullptr, 44100.0f);
+      effect->dispatcher(effect, effSetBlockSize, 0, static_cast<VstIntPtr>(blockSize), nullptr, 0.0f);
+
+      SampleBuffer<float> inputSampleBuffer(1, blockSize);
+      SampleBuffer<float> outputSampleBuffer(static_cast<ushort>(effect->numOutputs), blockSize);
+      VstEventRing eventRing;
+      eventRing.allocate(static_cast<ulong>(maxRun));
+
+      auto render = [&]() {
+        effect->dispatcher(effect, effMainsChanged, 0, 1, nullptr, 0.0f);
+        for (const auto& run : runs) {
+          if (run.size > 0) {
+            size_t numDropped;
+            eventRing.prepare(Span<const MidiEvent>(sequence.data() + run.first, run.size),
+              Span<VstMidiEvent>(track.vstSequence.data() + run.first, run.size), run.startFrame, numDropped);
+            VstEvents* vstEvents = eventRing.dispatch();
+            if (vstEvents != nullptr) {
+              effect->dispatcher(effect, effProcessEvents, 0, 0, vstEvents, 0.0f);
+            }
+          }
+          effect->processReplacing(effect, inputSampleBuffer.getSamples(), outputSampleBuffer.getSamples(),
+            static_cast<VstInt32>(run.numFrames));
+          eventRing.retire();
+        }
+        effect->dispatcher(effect, effMainsChanged, 0, 0, nullptr, 0.0f);
+        benchmarkSink += static_cast<uint>(outputSampleBuffer.getSamples()[0][0] != 0.0f);
+      };
+
+      BenchmarkResult result;
+      result.name = "referenceInstrument/" + input.name + "/burn" + std::to_string(burn);
+      result.bytesAllocated = measureAllocation(render);
+      double secondsPerCall = measure(render);
+      result.nsPerIteration = secondsPerCall * 1e9;
+      result.samplesPerSecond = static_cast<double>(numBlocks * blockSize) / secondsPerCall;
+      benchmarkResults.push_back(result);
+
+      effect->dispatcher(effect, effClose, 0, 0, nullptr, 0.0f);
+
+      std::cout << std::left << std::setw(28) << input.name << std::setw(8) << burn << std::right <<
+        std::setw(10) << numBlocks << std::fixed << std::setprecision(1) << std::setw(12) <<
+        secondsPerCall * 1e6 / numBlocks << std::setw(12) << *result.samplesPerSecond / 44100.0 << std::setw(12) <<
+        (result.bytesAllocated ? std::to_string(*result.bytesAllocated / 1024) : std::string("-")) << std::endl;
+    }
+  }
+}
+
+// PcmWavFile::writeBuffer to a real file, ten seconds of stereo noise per
+// iteration including opening and closing it
+static void benchmarkWavWriting(const std::filesystem::path& dir) {
+  const ushort numChannels = 2;
+  const ulong blockSize = 512;
+  const uint sampleRate = 44100;
+  const ulong numBlocks = 10 * sampleRate / blockSize;
+  const std::string fileName = (dir / "writeBuffer.wav").string();
+
+  const struct {
+    const char* name;
+    AudioBitDepth bitDepth;
+  } formats[] = {
+    { "pcm16", AudioBitDepth::Type16 },
+    { "pcm24", AudioBitDepth::Type24 },
+    { "float", AudioBitDepth::TypeFloat32 },
+  };
+
+  std::cout << std::left << std::setw(28) << "writeBuffer" << std::right << std::setw(14) << "Msamples/s" <<
+    std::setw(12) << "KB alloc" << std::endl;
+
+  VstSampleBuffer sampleBuffer(numChannels, blockSize);
+  fillNoise(sampleBuffer);
+  for (const auto& format : formats) {
+    auto write = [&]() {
+      PcmWavFile pcmWavFile;
+      pcmWavFile.openWrite(fileName, numChannels, sampleRate, format.bitDepth);
+      for (ulong block = 0; block < numBlocks; ++block) {
+        pcmWavFile.writeBuffer(sampleBuffer, blockSize);
+      }
+      benchmarkSink += pcmWavFile.closeWrite() ? 1 : 0;
+    };
+
+    BenchmarkResult result;
+    result.name = std::string("writeBuffer/") + format.name;
+    result.bytesAllocated = measureAllocation(write);
+    double secondsPerCall = measure(write);
+    result.nsPerIteration = secondsPerCall * 1e9;
+    result.samplesPerSecond = static_cast<double>(numChannels * blockSize * numBlocks) / secondsPerCall;
+    benchmarkResults.push_back(result);
+
+    std::cout << std::left << std::setw(28) << format.name << std::right << std::fixed << std::setprecision(1) <<
+      std::setw(14) << *result.samplesPerSecond / 1e6 << std::setw(12) <<
+      (result.bytesAllocated ? std::to_string(*result.bytesAllocated / 1024) : std::string("-")) << std::endl;
+  }
+
+  std::error_code error;
+  std::filesystem::remove(fileName, error);
+}
+
+// Same keys for every result, in the order they ran, so successive runs diff cleanly
+static bool writeJson(const std::string& fileName) {
+  std::ofstream ofs(fileName, std::ios::trunc);
+  if (!ofs) {
+    std::cerr << "Unable to create " << fileName << std::endl;
+    return false;
+  }
+
+  auto writeValue = [&ofs](const auto& value) {
+    if (value) {
+      ofs << *value;
+    }
+    else {
+      ofs << "null";
+    }
+  };
+
+  ofs << std::fixed << std::setprecision(3);
+  ofs << "{" << std::endl;
+  ofs << "  \"version\": 1," << std::endl;
+  ofs << "  \"minSeconds\": " << minSecondsPerBenchmark << "," << std::endl;
+  ofs << "  \"midiSeed\": " << midiSeed << "," << std::endl;
+  ofs << "  \"midiScale\": " << midiScale << "," << std::endl;
+  ofs << "  \"allocationsCounted\": " << (AllocationCounter::isEnabled() ? "true" : "false") << "," << std::endl;
+  ofs << "  \"results\": [" << std::endl;
+  for (size_t i = 0; i < benchmarkResults.size(); ++i) {
+    const auto& result = benchmarkResults[i];
+    ofs << "    { \"name\": \"" << escapeJson(result.name) << "\"" <<
+      ", \"nsPerIteration\": " << result.nsPerIteration << ", \"nsPerEvent\": ";
+    writeValue(result.nsPerEvent);
+    ofs << ", \"eventsPerSecond\": ";
+    writeValue(result.eventsPerSecond);
+    ofs << ", \"samplesPerSecond\": ";
+    writeValue(result.samplesPerSecond);
+    ofs << ", \"bytesAllocated\": ";
+    writeValue(result.bytesAllocated);
+    ofs << " }" << (i + 1 < benchmarkResults.size() ? "," : "") << std::endl;
+  }
+  ofs << "  ]" << std::endl;
+  ofs << "}" << std::endl;
+
+  if (!ofs.good()) {
+    std::cerr << "Error while writing " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string jsonFileName;
+  std::string midiCorpusDir;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--json=", 0) == 0) {
+      jsonFileName = arg.substr(7);
+    }
+    else if (arg.rfind("--midi_corpus=", 0) == 0) {
+      midiCorpusDir = arg.substr(14);
+    }
+    else if (arg.rfind("--min_seconds=", 0) == 0) {
+      minSecondsPerBenchmark = atof(arg.substr(14).c_str());
+    }
+    else if (arg.rfind("--midi_seed=", 0) == 0) {
+      midiSeed = strtoull(arg.substr(12).c_str(), nullptr, 10);
+    }
+    else if (arg.rfind("--midi_scale=", 0) == 0) {
+      midiScale = atof(arg.substr(13).c_str());
+    }
+    else {
+      std::cerr << "Usage: " << argv[0] << " [--json=FILE] [--midi_corpus=DIR] [--min_seconds=S]" <<
+        " [--midi_seed=N] [--midi_scale=X]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::path workDir = std::filesystem::temp_directory_path(error) / "LearningVSTBench";
+  std::filesystem::create_directories(workDir, error);
+  if (error) {
+    std::cerr << "Unable to create " << workDir.string() << ": " << error.message() << std::endl;
+    return 1;
+  }
+
+  std::vector<MidiInput> midiInputs = writeSyntheticMidi(workDir);
+  if (!midiCorpusDir.empty()) {
+    auto corpusInputs = findCorpusMidi(midiCorpusDir);
+    midiInputs.insert(midiInputs.end(), corpusInputs.begin(), corpusInputs.end());
+  }
+
+  benchmarkConverters();
+  std::cout << std::endl;
+  benchmarkChannelCounts();
+  std::cout << std::endl;
+  benchmarkMidiParsing(midiInputs);
+  std::cout << std::endl;
+  benchmarkEventPacking(midiInputs);
+  std::cout << std::endl;
+  benchmarkReferenceInstrument(midiInputs);
+  std::cout << std::endl;
+  benchmarkWavWriting(workDir);
+  std::cout << std::endl;
+
+  // Last, as it leaves tracing on
+  benchmarkTraceZones();
+
+  std::filesystem::remove_all(workDir, error);
+
+  if (!jsonFileName.empty()) {
+    if (!writeJson(jsonFileName)) {
+      return 1;
+    }
+    std::cout << std::endl << "Results written to " << jsonFileName << std::endl;
+  }
+  return 0;
+}